@@ -0,0 +1,14 @@
+QT = core serialbus serialport
+
+TARGET = ../../jcModbusBench
+TEMPLATE = app
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+#Output
+MOC_DIR     = moc
+OBJECTS_DIR = obj
+
+SOURCES += main.cpp
+
+include(../modbuscore.pri)
@@ -0,0 +1,352 @@
+/****************************************************************************
+**
+** jcModbusBench
+**
+**  End to end benchmark: starts jcModbusSim, runs the CSV scripts through
+**  ScriptExecutor over TCP loopback and pty RTU at 9600/19200/115200 and
+**  reports per script
+**    requests/s, p50/p95/p99 round trip, loop cycle time, client CPU
+**
+**    jcModbusBench [-n 20] [--transport tcp,rtu19200] [--no-wait] [script.csv ...]
+**
+**  direct<baud> runs the pty RTU leg on RtuDirectMaster instead.
+**  --crc checks every Crc16 engine against the bitwise reference and
+**  prints ns per call and MB/s per engine and frame size.
+**
+****************************************************************************/
+
+#include "modbusscript.h"
+#include "modbussettings.h"
+#include "scriptexecutor.h"
+#include "crc16.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QModbusReply>
+#include <QModbusClient>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QTimer>
+#include <sys/resource.h>
+#include <algorithm>
+
+struct BenchResult {
+    int iRequests = 0;
+    int iErrors = 0;
+    QVector<qint64> listLatencyUs;
+    QVector<qint64> listCycleUs;
+    qint64 llWallNs = 0;
+    double dCpuS = 0;
+};
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1e6;
+}
+
+//exit code 0 = something called loop.quit() in time
+static bool waitFor(QEventLoop &loop, int iTimeoutMs)
+{
+    QTimer::singleShot(iTimeoutMs, &loop, [&loop]() { loop.exit(1); });
+    return loop.exec() == 0;
+}
+
+static qint64 percentile(const QVector<qint64> &listSorted, double dP)
+{
+    if (listSorted.isEmpty())
+        return 0;
+    int i = qBound(0, static_cast<int>(dP*listSorted.size() + 0.999999) - 1, listSorted.size() - 1);
+    return listSorted.at(i);
+}
+
+//start the simulator and read back the "tcp ..." or "rtu ..." endpoint line
+static bool startSim(QProcess &sim, const QString &sSimPath, const QStringList &listArgs,
+                     const QString &sKind, QString &sEndpoint)
+{
+    sim.start(sSimPath, listArgs);
+    if (!sim.waitForStarted(3000))
+        return false;
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 5000) {
+        if (!sim.canReadLine() && !sim.waitForReadyRead(500))
+            continue;
+        while (sim.canReadLine()) {
+            QString line = QString::fromLocal8Bit(sim.readLine()).trimmed();
+            if (line.startsWith(sKind + " ")) {
+                sEndpoint = line.mid(sKind.size() + 1);
+                return true;
+                }
+            }
+        }
+    return false;
+}
+
+//every engine against the bitwise reference: all 1 and 2 byte messages, then
+//every length up to 1 KiB at 16 alignments with a random start value
+static bool checkCrc(QTextStream &err)
+{
+    QByteArray buf(1024 + 16, 0);
+    QRandomGenerator gen(1);
+    for (int i = 0; i < buf.size(); i++)
+        buf[i] = static_cast<char>(gen.generate());
+
+    bool bOk = true;
+    for (int e = Crc16::eTable; e < Crc16::eEngineCount; e++) {
+        const Crc16::Engine engine = static_cast<Crc16::Engine>(e);
+        if (!Crc16::isSupported(engine))
+            continue;
+        int iBad = 0;
+        for (int w = 0; w < 0x10000; w++) {
+            const char msg[2] = {static_cast<char>(w & 0xFF), static_cast<char>(w >> 8)};
+            for (int iSize = 1; iSize <= ((w < 0x100) ? 1 : 2); iSize++)
+                if (Crc16::compute(engine, msg, iSize) != Crc16::compute(Crc16::eBitwise, msg, iSize))
+                    iBad++;
+            }
+        for (int iOffset = 0; iOffset < 16; iOffset++)
+            for (int iSize = 0; iSize <= 1024; iSize++) {
+                const quint16 crc = static_cast<quint16>(gen.generate());
+                const char *p = buf.constData() + iOffset;
+                if (Crc16::compute(engine, p, iSize, crc) != Crc16::compute(Crc16::eBitwise, p, iSize, crc))
+                    iBad++;
+                }
+        if (iBad) {
+            err << Crc16::name(engine) << ": " << iBad << " wrong CRCs" << endl;
+            bOk = false;
+            }
+        }
+    return bOk;
+}
+
+//each engine and size runs until 100 ms have passed, best of 3
+static void timeCrc(QTextStream &out)
+{
+    QByteArray buf(4096, 0);
+    QRandomGenerator gen(2);
+    for (int i = 0; i < buf.size(); i++)
+        buf[i] = static_cast<char>(gen.generate());
+
+    out << "crc engine    bytes     ns/call       MB/s   (modbus() uses "
+        << Crc16::name(Crc16::engine()) << ")" << endl;
+    volatile quint16 sink = 0;
+    for (int e = Crc16::eBitwise; e < Crc16::eEngineCount; e++) {
+        const Crc16::Engine engine = static_cast<Crc16::Engine>(e);
+        if (!Crc16::isSupported(engine))
+            continue;
+        for (int iSize : {8, 64, 256, 4096}) {
+            double dBestNs = 0;
+            for (int iRun = 0; iRun < 3; iRun++) {
+                QElapsedTimer timer;
+                qint64 llCalls = 0;
+                timer.start();
+                do {
+                    for (int i = 0; i < 256; i++)
+                        sink = sink ^ Crc16::compute(engine, buf.constData(), iSize);
+                    llCalls += 256;
+                    } while (timer.nsecsElapsed() < 100000000);
+                const double dNs = static_cast<double>(timer.nsecsElapsed())/llCalls;
+                if ((iRun == 0) || (dNs < dBestNs))
+                    dBestNs = dNs;
+                }
+            out << qSetFieldWidth(10) << left << Crc16::name(engine) << qSetFieldWidth(0) << " "
+                << qSetFieldWidth(6) << right << iSize
+                << qSetFieldWidth(12) << QString::number(dBestNs, 'f', 1)
+                << qSetFieldWidth(11) << QString::number(iSize*1000.0/dBestNs, 'f', 0)
+                << qSetFieldWidth(0) << endl;
+            }
+        }
+}
+
+static BenchResult runScript(QModbusClient *modbusDevice, const ModbusProgram &program, int iLoops,
+                             int iServerAddr, int iWindow)
+{
+    BenchResult result;
+    QHash<QModbusReply *, qint64> hashSentNs;   //before the executor, outlives its connections
+    ScriptExecutor executor;
+    executor.setDevice(modbusDevice);
+    executor.setScript(program);
+    executor.setWindow(iWindow);
+
+    QElapsedTimer timerTotal, timerLoop;
+    QEventLoop loop;
+    QObject::connect(&executor, &ScriptExecutor::requestSent, [&](int, QModbusReply *reply) {
+        result.iRequests++;
+        hashSentNs.insert(reply, timerTotal.nsecsElapsed());
+        //replies outlive this function, the hook goes with the executor
+        QObject::connect(reply, &QObject::destroyed, &executor, [&hashSentNs, reply]() { hashSentNs.remove(reply); });
+        });
+    QObject::connect(&executor, &ScriptExecutor::replyReady, [&](int, QModbusReply *reply, const QModbusDataUnit &) {
+        //merged reads report once per row, time the request once
+        if (!hashSentNs.contains(reply))
+            return;
+        result.listLatencyUs.append((timerTotal.nsecsElapsed() - hashSentNs.take(reply))/1000);
+        if (reply->error() != QModbusDevice::NoError)
+            result.iErrors++;
+        });
+    QObject::connect(&executor, &ScriptExecutor::loopStarted, [&](int) {
+        timerLoop.start();
+        });
+    QObject::connect(&executor, &ScriptExecutor::loopFinished, [&](int) {
+        result.listCycleUs.append(timerLoop.nsecsElapsed()/1000);
+        });
+    QObject::connect(&executor, &ScriptExecutor::finished, &loop, &QEventLoop::quit);
+
+    double dCpuS = cpuSeconds();
+    timerTotal.start();
+    QTimer::singleShot(0, &executor, [&]() { executor.start(iLoops, iServerAddr, false); });
+    loop.exec();
+    result.llWallNs = timerTotal.nsecsElapsed();
+    result.dCpuS = cpuSeconds() - dCpuS;
+    std::sort(result.listLatencyUs.begin(), result.listLatencyUs.end());
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("jcModbusBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Modbus client benchmark against jcModbusSim");
+    parser.addHelpOption();
+    parser.addPositionalArgument("scripts", "CSV scripts, default the shipped ones.", "[script.csv ...]");
+    QCommandLineOption optLoops(QStringList() << "n" << "loops", "Loops per script.", "count", "20");
+    QCommandLineOption optTransport("transport", "Comma list of tcp, rtu9600, rtu19200, rtu115200, direct115200.", "list",
+                                    "tcp,rtu9600,rtu19200,rtu115200");
+    QCommandLineOption optSim("sim", "Simulator executable.", "path",
+                              QCoreApplication::applicationDirPath() + "/jcModbusSim");
+    QCommandLineOption optPort("port", "Simulator TCP port.", "port", "15020");
+    QCommandLineOption optLatency("latency", "Simulated slave response delay in us.", "us", "0");
+    QCommandLineOption optJitter("jitter", "Simulated slave extra random delay in us.", "us", "0");
+    QCommandLineOption optNoWait("no-wait", "Ignore Wait(ms), measure the transport only.");
+    QCommandLineOption optCoalesce("coalesce-gap", "Merge Rr rows up to this many registers apart, -1 = off.", "regs", "-1");
+    QCommandLineOption optWindow(QStringList() << "w" << "window", "Modbus TCP requests kept in flight.", "count", "1");
+    QCommandLineOption optCrc("crc", "Check and time the CRC-16 engines, then exit.");
+    parser.addOptions({optLoops, optTransport, optSim, optPort, optLatency, optJitter, optNoWait, optCoalesce, optWindow,
+                       optCrc});
+    parser.process(a);
+    QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false"));
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if (parser.isSet(optCrc)) {
+        if (!checkCrc(err))
+            return 1;
+        timeCrc(out);
+        return 0;
+        }
+    const int iLoops = parser.value(optLoops).toInt();
+    QStringList listScripts = parser.positionalArguments();
+    if (listScripts.isEmpty()) {
+        for (const char *sName : {"00ModbusTC100INIT.csv", "01ModbusTC100.csv", "01ModbusTC100Loop.csv", "ModbusMC0162.csv"})
+            listScripts << QCoreApplication::applicationDirPath() + "/" + sName;
+        }
+
+    QVector<ModbusProgram> listPrograms;
+    for (const QString &sScript : listScripts) {
+        QList<QStringList> listCSV;
+        QStringList listHeader;
+        if (!ModbusScript::loadCSV(sScript, listCSV, listHeader)) {
+            err << "Can't open " << sScript << endl;
+            return 1;
+            }
+        ModbusProgram program = ModbusScript::coalesceWrites(
+                    ModbusScript::coalesceReads(ModbusScript::compile(listCSV), parser.value(optCoalesce).toInt()));
+        if (parser.isSet(optNoWait)) {
+            for (ModbusOp &op : program) {
+                if (!op.bPoll)
+                    op.wait = 0; //Poll rows keep it as their timeout
+                }
+            }
+        listPrograms.append(program);
+        }
+
+    out << "scenario   script                    req   err    req/s  p50 ms  p95 ms  p99 ms"
+           "   cycle avg/min/max ms        cpu%" << endl;
+    bool bFailed = false;
+    for (const QString &sTransport : parser.value(optTransport).split(',', QString::SkipEmptyParts)) {
+        const bool bTcp = (sTransport == "tcp");
+        const bool bDirect = sTransport.startsWith("direct");
+        const int iBaud = bTcp ? 0 : sTransport.mid(bDirect ? 6 : 3).toInt();
+        if (!bTcp && ((!sTransport.startsWith("rtu") && !bDirect) || (iBaud <= 0))) {
+            err << "Unknown transport " << sTransport << endl;
+            return 1;
+            }
+
+        QStringList listArgs;
+        listArgs << "--latency" << parser.value(optLatency) << "--jitter" << parser.value(optJitter);
+        if (bTcp)
+            listArgs << "-t" << parser.value(optPort);
+        else
+            listArgs << "-t" << "0" << "-r" << "-b" << QString::number(iBaud);
+        QProcess sim;
+        QString sEndpoint;
+        if (!startSim(sim, parser.value(optSim), listArgs, bTcp ? "tcp" : "rtu", sEndpoint)) {
+            err << "Can't start " << parser.value(optSim) << endl;
+            return 1;
+            }
+
+        ModbusSettings settings;
+        settings.baud = iBaud;
+        QModbusClient *modbusDevice;
+        if (bTcp)
+            modbusDevice = createModbusClient(eTransportTcp, nullptr, &a);
+        else
+            modbusDevice = createModbusClient(bDirect ? eTransportRtuDirect : eTransportRtu, nullptr, &a);
+        applyModbusSettings(modbusDevice, sEndpoint, settings);
+
+        QEventLoop loopConnect;
+        QObject::connect(modbusDevice, &QModbusClient::stateChanged, &loopConnect, [&](QModbusDevice::State state) {
+            if (state == QModbusDevice::ConnectedState)
+                loopConnect.quit();
+            });
+        if (!modbusDevice->connectDevice() || !waitFor(loopConnect, 5000)) {
+            err << sTransport << ": connect to " << sEndpoint << " failed: " << modbusDevice->errorString() << endl;
+            bFailed = true;
+            }
+        else {
+            for (int s = 0; s < listPrograms.size(); s++) {
+                BenchResult result = runScript(modbusDevice, listPrograms.at(s), iLoops, 1,
+                                               bTcp ? parser.value(optWindow).toInt() : 1);
+                qint64 llMin = 0, llMax = 0, llSum = 0;
+                if (!result.listCycleUs.isEmpty())
+                    llMin = result.listCycleUs.first();
+                for (qint64 llUs : result.listCycleUs) {
+                    llMin = qMin(llMin, llUs);
+                    llMax = qMax(llMax, llUs);
+                    llSum += llUs;
+                    }
+                double dWallS = result.llWallNs/1e9;
+                out << qSetFieldWidth(10) << left << sTransport << qSetFieldWidth(0) << " "
+                    << qSetFieldWidth(22) << QFileInfo(listScripts.at(s)).fileName().left(22)
+                    << right << qSetFieldWidth(6) << result.iRequests << result.iErrors
+                    << qSetFieldWidth(9) << fixed << qSetRealNumberPrecision(1) << (dWallS > 0 ? result.iRequests/dWallS : 0.0)
+                    << qSetFieldWidth(8) << qSetRealNumberPrecision(2)
+                    << percentile(result.listLatencyUs, 0.50)/1000.0
+                    << percentile(result.listLatencyUs, 0.95)/1000.0
+                    << percentile(result.listLatencyUs, 0.99)/1000.0
+                    << qSetFieldWidth(10) << qSetRealNumberPrecision(1)
+                    << (result.listCycleUs.isEmpty() ? 0.0 : llSum/1000.0/result.listCycleUs.size())
+                    << llMin/1000.0 << llMax/1000.0
+                    << qSetFieldWidth(8) << (dWallS > 0 ? result.dCpuS*100.0/dWallS : 0.0)
+                    << qSetFieldWidth(0) << reset << endl;
+                if (result.iErrors)
+                    bFailed = true;
+                }
+            modbusDevice->disconnectDevice();
+            }
+        delete modbusDevice;
+        sim.terminate();
+        if (!sim.waitForFinished(2000))
+            sim.kill();
+        }
+    return bFailed ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+#include "bussniffer.h"
+#include "crc16.h"
+#include "serialtty.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static const int kHeaderBytes = 11;     //enough to size any frame, FC23 requests being the longest
+
+//ADU lengths of a frame with this header as a request and as a response, 0 = unknown (yet)
+static void frameLengths(const quint8 *hdr, int iHave, int &iRequest, int &iResponse)
+{
+    iRequest = 0;
+    iResponse = 0;
+    if (iHave < 2)
+        return;
+    if (hdr[1] & 0x80) {
+        iResponse = 5;
+        return;
+        }
+    switch (hdr[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04:
+            iRequest = 8;
+            if (iHave >= 3)
+                iResponse = 5 + hdr[2];
+            break;
+        case 0x05: case 0x06:
+            iRequest = 8;
+            iResponse = 8;
+            break;
+        case 0x0F: case 0x10:
+            if (iHave >= 7)
+                iRequest = 9 + hdr[6];
+            iResponse = 8;
+            break;
+        case 0x17:
+            if (iHave >= 11)
+                iRequest = 13 + hdr[10];
+            if (iHave >= 3)
+                iResponse = 5 + hdr[2];
+            break;
+        default:
+            break;
+        }
+}
+
+BusSniffer::BusSniffer(QObject *parent)
+    : QThread(parent)
+{
+}
+
+BusSniffer::~BusSniffer()
+{
+    close();
+    delete[] m_pRing;
+}
+
+bool BusSniffer::open(const QString &sPort, const ModbusSettings &settings, QString &sError)
+{
+    close();
+    m_fd = openSerialTty(sPort, settings.baud, settings.parity, settings.dataBits, settings.stopBits, sError);
+    if (m_fd < 0)
+        return false;
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((m_epfd < 0) || (m_timerfd < 0) || (m_wakefd < 0)) {
+        sError = QString::fromLocal8Bit(strerror(errno));
+        close();
+        return false;
+        }
+    for (int fd : {m_fd, m_timerfd, m_wakefd}) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+    if (!m_pRing)
+        m_pRing = new char[kRingBytes];
+    m_uTail.store(0);
+    m_llFrames = 0;
+    m_llDropped = 0;
+    m_request = Request();
+    m_llGapNs = serialFrameGapNs(settings.baud, settings.parity, settings.dataBits, settings.stopBits);
+    m_llStartNs = monotonicNs();
+    start(QThread::HighPriority);
+    return true;
+}
+
+void BusSniffer::close()
+{
+    if (isRunning()) {
+        const quint64 one = 1;
+        if (::write(m_wakefd, &one, sizeof(one)) < 0)
+            qWarning() << "BusSniffer wake failed:" << strerror(errno);
+        wait();
+        }
+    for (int *pFd : {&m_fd, &m_epfd, &m_timerfd, &m_wakefd}) {
+        if (*pFd >= 0)
+            ::close(*pFd);
+        *pFd = -1;
+        }
+    //frames of this session point into a ring the next one starts over
+    SniffFrame frame;
+    while (m_ringFrames.pop(frame)) {}
+    m_bPending.store(false);
+}
+
+quint16 BusSniffer::crcAt(quint64 uPos, int iSize) const
+{
+    const quint64 uOffset = uPos & (kRingBytes - 1);
+    const int iFirst = static_cast<int>(qMin<quint64>(iSize, kRingBytes - uOffset));
+    quint16 crc = Crc16::compute(Crc16::engine(), m_pRing + uOffset, iFirst);
+    if (iFirst < iSize)
+        crc = Crc16::compute(Crc16::engine(), m_pRing, iSize - iFirst, crc);
+    return crc;
+}
+
+//shortest complete request or response at uStart whose CRC checks out, 0 = none yet
+int BusSniffer::splitLength(quint64 uStart, int iHave) const
+{
+    quint8 hdr[kHeaderBytes];
+    const int iHeader = qMin(iHave, kHeaderBytes);
+    for (int i = 0; i < iHeader; i++)
+        hdr[i] = at(uStart + i);
+    int iRequest, iResponse;
+    frameLengths(hdr, iHeader, iRequest, iResponse);
+    for (int iLength : {qMin(iRequest, iResponse), qMax(iRequest, iResponse)}) {
+        if ((iLength < 4) || (iLength > iHave))
+            continue;
+        if (crcAt(uStart, iLength - 2) == (at(uStart + iLength - 2) | (at(uStart + iLength - 1) << 8)))
+            return iLength;
+        }
+    return 0;
+}
+
+void BusSniffer::pushFrame(quint64 uStart, int iSize, qint64 llStampNs)
+{
+    SniffFrame frame;
+    frame.uOffset = uStart;
+    frame.iSize = iSize;
+    frame.llStampNs = llStampNs;
+    frame.bCrcOk = (iSize >= 4)
+            && (crcAt(uStart, iSize - 2) == (at(uStart + iSize - 2) | (at(uStart + iSize - 1) << 8)));
+    if (!m_ringFrames.push(frame)) {
+        m_llDropped++;
+        return;
+        }
+    m_llFrames++;
+    if (!m_bPending.exchange(true))
+        emit framesPending();
+}
+
+//reader thread: the tty goes straight into the ring, frames are cut in place
+void BusSniffer::run()
+{
+    quint64 uHead = m_uTail.load(std::memory_order_acquire);
+    quint64 uStart = uHead;     //first byte of the frame being received
+    qint64 llFirstNs = 0;
+    qint64 llLastNs = 0;
+    char scratch[512];
+    forever {
+        armTimerNs(m_timerfd, (uHead != uStart) ? llLastNs + m_llGapNs : 0);   //0 disarms
+
+        epoll_event events[3];
+        const int n = epoll_wait(m_epfd, events, 3, -1);
+        if ((n < 0) && (errno != EINTR)) {
+            qWarning() << "BusSniffer epoll failed:" << strerror(errno);
+            return;
+            }
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == m_wakefd)
+                return;
+            if (fd == m_timerfd) {
+                quint64 expirations;
+                if (::read(m_timerfd, &expirations, sizeof(expirations)) < 0) {}
+                if ((uHead != uStart) && (monotonicNs() >= llLastNs + m_llGapNs)) {
+                    pushFrame(uStart, static_cast<int>(uHead - uStart), llFirstNs);  //line idle for t3.5
+                    uStart = uHead;
+                    }
+                continue;
+                }
+
+            forever {
+                if (uHead - uStart >= static_cast<quint64>(kMaxFrame)) {
+                    pushFrame(uStart, kMaxFrame, llFirstNs);   //longer than any ADU, shows up as bad
+                    uStart = uHead;
+                    }
+                const quint64 uFree = kRingBytes - (uHead - m_uTail.load(std::memory_order_acquire));
+                ssize_t r;
+                if (uFree == 0) {
+                    r = ::read(m_fd, scratch, sizeof(scratch));
+                    if (r > 0)
+                        m_llDropped += r;
+                    }
+                else {
+                    const quint64 uRoom = qMin(qMin(uFree, kRingBytes - (uHead & (kRingBytes - 1))),
+                                               static_cast<quint64>(kMaxFrame) - (uHead - uStart));
+                    r = ::read(m_fd, m_pRing + (uHead & (kRingBytes - 1)), uRoom);
+                    if (r > 0) {
+                        llLastNs = monotonicNs();
+                        if (uHead == uStart)
+                            llFirstNs = llLastNs;
+                        uHead += r;
+                        //back to back frames inside one read: cut where a complete frame checks out
+                        int iLength;
+                        while ((uHead != uStart) && ((iLength = splitLength(uStart, static_cast<int>(uHead - uStart))) > 0)) {
+                            pushFrame(uStart, iLength, llFirstNs);
+                            uStart += iLength;
+                            llFirstNs = llLastNs;
+                            }
+                        }
+                    }
+                if (r > 0)
+                    continue;
+                if ((r < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+                    qWarning() << "BusSniffer read failed:" << strerror(errno);
+                    return;
+                    }
+                break;
+                }
+            }
+        }
+}
+
+QString BusSniffer::hexAt(quint64 uPos, int iSize) const
+{
+    QString sHex;
+    const int iShown = qMin(iSize, 32);
+    for (int i = 0; i < iShown; i++)
+        sHex += QString::asprintf(i ? " %02X" : "%02X", at(uPos + i));
+    if (iShown < iSize)
+        sHex += " ...";
+    return sHex;
+}
+
+//consumer thread: the bytes are read out of the ring only here
+bool BusSniffer::nextLine(QString &sLine, Kind &kind)
+{
+    SniffFrame frame;
+    if (!m_ringFrames.pop(frame))
+        return false;
+
+    const quint64 uPos = frame.uOffset;
+    const int iSize = frame.iSize;
+    auto word = [this, uPos](int i) { return (at(uPos + i) << 8) | at(uPos + i + 1); };
+    auto words = [this, uPos](int i, int iBytes) {
+        QString sWords;
+        for (int w = 0; w + 1 < iBytes; w += 2)
+            sWords += QString::asprintf(w ? " %04X" : "%04X", (at(uPos + i + w) << 8) | at(uPos + i + w + 1));
+        return sWords;
+        };
+
+    sLine = QString::asprintf("%10.3f ", (frame.llStampNs - m_llStartNs)/1e6);
+    if (!frame.bCrcOk) {
+        kind = eBadFrame;
+        sLine += "bad  " + hexAt(uPos, iSize);
+        m_uTail.store(uPos + iSize, std::memory_order_release);
+        return true;
+        }
+
+    const quint8 slave = at(uPos);
+    const quint8 fc = at(uPos + 1) & 0x7F;
+    const bool bException = at(uPos + 1) & 0x80;
+    quint8 hdr[kHeaderBytes];
+    const int iHeader = qMin(iSize, kHeaderBytes);
+    for (int i = 0; i < iHeader; i++)
+        hdr[i] = at(uPos + i);
+    int iRequest, iResponse;
+    frameLengths(hdr, iHeader, iRequest, iResponse);
+    const bool bPaired = m_request.bValid && (m_request.slave == slave) && (m_request.fc == fc);
+    bool bResponse;
+    if (bException)
+        bResponse = true;
+    else if ((iSize == iRequest) != (iSize == iResponse))
+        bResponse = (iSize == iResponse);
+    else
+        bResponse = bPaired;    //same size both ways, e.g. the FC5/FC6 echo
+
+    sLine += QString::asprintf("s%-3d fc%02X ", slave, fc);
+    const int iData = iSize - 4;    //between fc and crc
+    if (!bResponse) {
+        kind = eRequest;
+        m_request.bValid = true;
+        m_request.slave = slave;
+        m_request.fc = fc;
+        m_request.address = (iSize >= 6) ? word(2) : 0;
+        m_request.count = (iSize >= 8) ? word(4) : 0;
+        m_request.llStampNs = frame.llStampNs;
+        switch (fc) {
+            case 0x01: case 0x02: case 0x03: case 0x04:
+                sLine += QString::asprintf("req  0x%04X x%d", m_request.address, m_request.count);
+                break;
+            case 0x05: case 0x06:
+                sLine += QString::asprintf("req  0x%04X = %04X", m_request.address, m_request.count);
+                break;
+            case 0x0F:
+                sLine += QString::asprintf("req  0x%04X x%d [", m_request.address, m_request.count)
+                        + hexAt(uPos + 7, iSize - 9) + "]";
+                break;
+            case 0x10:
+                sLine += QString::asprintf("req  0x%04X x%d [", m_request.address, m_request.count)
+                        + words(7, iSize - 9) + "]";
+                break;
+            case 0x17:
+                sLine += QString::asprintf("req  r0x%04X x%d w0x%04X x%d [", word(2), word(4), word(6), word(8))
+                        + words(11, iSize - 13) + "]";
+                break;
+            default:
+                sLine += "req  " + hexAt(uPos + 2, iData);
+                break;
+            }
+        }
+    else {
+        kind = bException ? eException : eResponse;
+        const QString sAddress = bPaired ? QString::asprintf("@0x%04X ", m_request.address) : QString();
+        if (bException) {
+            sLine += QString::asprintf("exc  code %d", at(uPos + 2));
+            }
+        else {
+            switch (fc) {
+                case 0x01: case 0x02:
+                    sLine += "rsp  " + sAddress + "[" + hexAt(uPos + 3, iSize - 5) + "]";
+                    break;
+                case 0x03: case 0x04: case 0x17:
+                    sLine += "rsp  " + sAddress + "[" + words(3, iSize - 5) + "]";
+                    break;
+                case 0x05: case 0x06:
+                    sLine += QString::asprintf("rsp  0x%04X = %04X", word(2), word(4));
+                    break;
+                case 0x0F: case 0x10:
+                    sLine += QString::asprintf("rsp  0x%04X x%d", word(2), word(4));
+                    break;
+                default:
+                    sLine += "rsp  " + hexAt(uPos + 2, iData);
+                    break;
+                }
+            }
+        if (bPaired)
+            sLine += QString::asprintf("  %.1f ms", (frame.llStampNs - m_request.llStampNs)/1e6);
+        m_request.bValid = false;
+        }
+    m_uTail.store(uPos + iSize, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,96 @@
+/****************************************************************************
+**
+** BusSniffer
+**
+**  Passive listener on a second RS-485 adapter. The reader thread reads
+**  the tty straight into a 1 MiB byte ring and cuts frames there: at the
+**  first length whose CRC checks out (a request or a response of a known
+**  function code) or after t3.5 of silence. Only a small descriptor per
+**  frame crosses to the consumer; the bytes stay in the ring until
+**  nextLine() decodes and formats them, pairing every response with the
+**  request before it. Bytes and frames that find the rings full are
+**  counted, never waited for. Linux only, see serialtty.h.
+**
+****************************************************************************/
+
+#ifndef BUSSNIFFER_H
+#define BUSSNIFFER_H
+
+#include <QThread>
+#include <QString>
+#include <atomic>
+
+#include "modbussettings.h"
+#include "spscring.h"
+
+struct SniffFrame
+{
+    quint64 uOffset = 0;    //free running position of the first byte in the ring
+    int     iSize = 0;
+    qint64  llStampNs = 0;  //monotonic, first byte
+    bool    bCrcOk = false;
+};
+
+class BusSniffer : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Kind { eRequest, eResponse, eException, eBadFrame };
+
+    explicit BusSniffer(QObject *parent = nullptr);
+    ~BusSniffer();
+
+    bool open(const QString &sPort, const ModbusSettings &settings, QString &sError);
+    void close();
+    bool isOpen() const { return m_fd >= 0; }
+
+    //consumer thread: one decoded frame per call, false when none is left
+    bool nextLine(QString &sLine, Kind &kind);
+    void clearPending() { m_bPending.store(false); }
+    qint64 frames() const { return m_llFrames; }
+    qint64 takeDropped() { return m_llDropped.exchange(0); }
+
+signals:
+    void framesPending();
+
+protected:
+    void run() override;
+
+private:
+    static const int kRingBits = 20;
+    static const quint64 kRingBytes = Q_UINT64_C(1) << kRingBits;
+    static const int kMaxFrame = 256;
+
+    quint8 at(quint64 uPos) const { return static_cast<quint8>(m_pRing[uPos & (kRingBytes - 1)]); }
+    quint16 crcAt(quint64 uPos, int iSize) const;
+    int splitLength(quint64 uStart, int iHave) const;
+    void pushFrame(quint64 uStart, int iSize, qint64 llStampNs);
+    QString hexAt(quint64 uPos, int iSize) const;
+
+    char *m_pRing = nullptr;
+    int m_fd = -1;
+    int m_epfd = -1;
+    int m_timerfd = -1;
+    int m_wakefd = -1;
+    qint64 m_llGapNs = 0;
+    qint64 m_llStartNs = 0;
+
+    SpscRing<SniffFrame, 4096> m_ringFrames;
+    alignas(64) std::atomic<quint64> m_uTail{0};   //ring bytes the consumer is done with
+    std::atomic<bool> m_bPending{false};
+    std::atomic<qint64> m_llFrames{0};
+    std::atomic<qint64> m_llDropped{0};             //bytes and frames lost to full rings
+
+    //consumer side: the last request, for pairing
+    struct Request {
+        bool    bValid = false;
+        quint8  slave = 0;
+        quint8  fc = 0;
+        quint16 address = 0;
+        quint16 count = 0;
+        qint64  llStampNs = 0;
+    } m_request;
+};
+
+#endif // BUSSNIFFER_H
@@ -0,0 +1,87 @@
+#include "consolemodel.h"
+
+#include <QBrush>
+
+static const int kFlushMs = 33;     //about 30 repaints a second at most
+
+ConsoleModel::ConsoleModel(int iCapacity, QObject *parent)
+    : QAbstractListModel(parent), m_listRing(qMax(1, iCapacity))
+{
+    m_timerFlush.setSingleShot(true);
+    m_timerFlush.setInterval(kFlushMs);
+    connect(&m_timerFlush, &QTimer::timeout, this, &ConsoleModel::flush);
+}
+
+int ConsoleModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_iSize;
+}
+
+QVariant ConsoleModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || (index.row() < 0) || (index.row() >= m_iSize))
+        return QVariant();
+
+    const ConsoleRecord &rec = record(index.row());
+    switch (role) {
+        case Qt::DisplayRole:
+            return rec.sText;
+        case Qt::ForegroundRole:
+            switch (rec.level) {
+                case ConsoleRecord::eReply:     return QBrush(Qt::blue);
+                case ConsoleRecord::eException: return QBrush(Qt::magenta);
+                case ConsoleRecord::eError:     return QBrush(Qt::red);
+                default:                        break;
+                }
+            break;
+        }
+    return QVariant();
+}
+
+void ConsoleModel::append(const QString &sText, ConsoleRecord::Level level)
+{
+    ConsoleRecord rec;
+    rec.level = level;
+    rec.sText = sText;
+    m_listPending.append(rec);
+    if (m_listPending.size() > m_listRing.size())
+        m_listPending.remove(0, m_listPending.size() - m_listRing.size()); //would scroll out unseen
+    if (!m_timerFlush.isActive())
+        m_timerFlush.start();
+}
+
+void ConsoleModel::flush()
+{
+    m_timerFlush.stop();
+    if (m_listPending.isEmpty())
+        return;
+
+    const int iCapacity = m_listRing.size();
+    const int iNew = m_listPending.size();
+    const int iDrop = qMax(0, m_iSize + iNew - iCapacity);
+    if (iDrop > 0) {
+        beginRemoveRows(QModelIndex(), 0, iDrop - 1);
+        m_iHead = (m_iHead + iDrop) % iCapacity;
+        m_iSize -= iDrop;
+        endRemoveRows();
+        }
+
+    beginInsertRows(QModelIndex(), m_iSize, m_iSize + iNew - 1);
+    for (int i = 0; i < iNew; i++)
+        m_listRing[(m_iHead + m_iSize + i) % iCapacity] = m_listPending.at(i);
+    m_iSize += iNew;
+    endInsertRows();
+    m_listPending.clear();
+}
+
+void ConsoleModel::clear()
+{
+    m_timerFlush.stop();
+    beginResetModel();
+    m_listPending.clear();
+    for (ConsoleRecord &rec : m_listRing)
+        rec.sText.clear();
+    m_iHead = 0;
+    m_iSize = 0;
+    endResetModel();
+}
@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** ConsoleModel
+**
+**  Script console as a list model over a fixed-capacity ring of records,
+**  shown in a QListView with uniform item sizes so only the visible lines
+**  are laid out. append() only queues; the queue goes into the ring and
+**  out to the view in one insert at most every kFlushMs, the oldest lines
+**  drop off the front once the ring is full.
+**
+****************************************************************************/
+
+#ifndef CONSOLEMODEL_H
+#define CONSOLEMODEL_H
+
+#include <QAbstractListModel>
+#include <QTimer>
+#include <QVector>
+
+struct ConsoleRecord
+{
+    enum Level { eText, eReply, eException, eError };
+
+    Level   level = eText;
+    QString sText;
+};
+Q_DECLARE_TYPEINFO(ConsoleRecord, Q_MOVABLE_TYPE);
+
+class ConsoleModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit ConsoleModel(int iCapacity, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+
+    void append(const QString &sText, ConsoleRecord::Level level = ConsoleRecord::eText);
+
+public slots:
+    void flush();
+    void clear();
+
+private:
+    const ConsoleRecord &record(int row) const { return m_listRing.at((m_iHead + row) % m_listRing.size()); }
+
+    QVector<ConsoleRecord> m_listRing;
+    int m_iHead = 0;        //oldest record
+    int m_iSize = 0;
+    QVector<ConsoleRecord> m_listPending;
+    QTimer m_timerFlush;
+};
+
+#endif // CONSOLEMODEL_H
@@ -0,0 +1,255 @@
+#include "crc16.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC16_CLMUL_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC16_CLMUL_ARM
+#endif
+
+static const quint16 kPoly = 0xA001;    //0x8005 bit reversed
+static const int kClmulMinBytes = 48;   //below this the fold setup costs more than it saves
+
+static quint16 crcBitwise(const char *p, int iSize, quint16 crc)
+{
+    while (iSize-- > 0) {
+        crc ^= static_cast<quint8>(*p++);
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ kPoly : (crc >> 1);
+        }
+    return crc;
+}
+
+/*** tables: [0] one byte, [k] one byte followed by k zero bytes ***/
+
+struct CrcTables
+{
+    quint16 t[8][256];
+
+    CrcTables()
+    {
+        for (int b = 0; b < 256; b++) {
+            const char byte = static_cast<char>(b);
+            t[0][b] = crcBitwise(&byte, 1, 0);
+            }
+        for (int k = 1; k < 8; k++)
+            for (int b = 0; b < 256; b++)
+                t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+    }
+};
+
+static const CrcTables &tables()
+{
+    static const CrcTables s_tables;
+    return s_tables;
+}
+
+static quint16 crcTable(const char *p, int iSize, quint16 crc)
+{
+    const quint16 (&t)[256] = tables().t[0];
+    while (iSize-- > 0)
+        crc = (crc >> 8) ^ t[(crc ^ static_cast<quint8>(*p++)) & 0xFF];
+    return crc;
+}
+
+static quint64 loadLE64(const char *p)
+{
+    quint64 w;
+    memcpy(&w, p, 8);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+static quint16 crcSlice8(const char *p, int iSize, quint16 crc)
+{
+    const CrcTables &tab = tables();
+    while (iSize >= 8) {
+        const quint64 w = loadLE64(p) ^ crc;
+        crc = tab.t[7][w & 0xFF] ^ tab.t[6][(w >> 8) & 0xFF]
+            ^ tab.t[5][(w >> 16) & 0xFF] ^ tab.t[4][(w >> 24) & 0xFF]
+            ^ tab.t[3][(w >> 32) & 0xFF] ^ tab.t[2][(w >> 40) & 0xFF]
+            ^ tab.t[1][(w >> 48) & 0xFF] ^ tab.t[0][w >> 56];
+        p += 8;
+        iSize -= 8;
+        }
+    return crcTable(p, iSize, crc);
+}
+
+/*** carry-less multiply fold ***
+**
+**  A 16 byte block is X = H*x^64 + L in the reflected bit order (first bit
+**  on the wire = highest power). Followed by the next block N the message
+**  is X*x^128 + N, congruent mod P to H*(x^192 mod P) + L*(x^128 mod P) + N,
+**  both products below 80 bits. A carry-less product of two reflected
+**  64-bit values comes out multiplied by x once more, so the fold constants
+**  are x^191 and x^127 mod P. The last block goes through the table with a
+**  zero start, which is exactly X*x^16 mod P.
+*/
+
+#if defined(CRC16_CLMUL_X86) || defined(CRC16_CLMUL_ARM)
+
+struct FoldConstants
+{
+    quint64 k1;     //x^191 mod P, for H
+    quint64 k2;     //x^127 mod P, for L
+
+    FoldConstants() : k1(reflectedPower(191)), k2(reflectedPower(127)) {}
+
+    //x^n mod P as a reflected 64-bit operand, bit i = coefficient of x^(63-i)
+    static quint64 reflectedPower(int n)
+    {
+        quint32 r = 1;  //normal order, bit d = coefficient of x^d
+        for (int i = 0; i < n; i++) {
+            r <<= 1;
+            if (r & 0x10000)
+                r ^= 0x18005;
+            }
+        quint64 rep = 0;
+        for (int d = 0; d < 16; d++)
+            if (r & (1u << d))
+                rep |= Q_UINT64_C(1) << (63 - d);
+        return rep;
+    }
+};
+
+static const FoldConstants &foldConstants()
+{
+    static const FoldConstants s_constants;
+    return s_constants;
+}
+
+#endif
+
+#if defined(CRC16_CLMUL_X86)
+
+__attribute__((target("pclmul,sse2")))
+static quint16 crcClmul(const char *p, int iSize, quint16 crc)
+{
+    if (iSize < kClmulMinBytes)
+        return crcSlice8(p, iSize, crc);
+
+    const FoldConstants &fold = foldConstants();
+    const __m128i k = _mm_set_epi64x(static_cast<qint64>(fold.k2), static_cast<qint64>(fold.k1));
+    __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), _mm_cvtsi32_si128(crc));
+    p += 16;
+    iSize -= 16;
+    while (iSize >= 16) {
+        const __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), n);
+        p += 16;
+        iSize -= 16;
+        }
+    char block[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(block), x);
+    return crcSlice8(p, iSize, crcSlice8(block, 16, 0));
+}
+
+static bool hasClmul()
+{
+    return __builtin_cpu_supports("pclmul");
+}
+
+#elif defined(CRC16_CLMUL_ARM)
+
+static quint16 crcClmul(const char *p, int iSize, quint16 crc)
+{
+    if (iSize < kClmulMinBytes)
+        return crcSlice8(p, iSize, crc);
+
+    const FoldConstants &fold = foldConstants();
+    uint64x2_t x = veorq_u64(vld1q_u64(reinterpret_cast<const uint64_t *>(p)),
+                             vcombine_u64(vcreate_u64(crc), vcreate_u64(0)));
+    p += 16;
+    iSize -= 16;
+    while (iSize >= 16) {
+        const uint64x2_t lo = vreinterpretq_u64_p128(vmull_p64(static_cast<poly64_t>(vgetq_lane_u64(x, 0)), static_cast<poly64_t>(fold.k1)));
+        const uint64x2_t hi = vreinterpretq_u64_p128(vmull_p64(static_cast<poly64_t>(vgetq_lane_u64(x, 1)), static_cast<poly64_t>(fold.k2)));
+        x = veorq_u64(veorq_u64(lo, hi), vld1q_u64(reinterpret_cast<const uint64_t *>(p)));
+        p += 16;
+        iSize -= 16;
+        }
+    char block[16];
+    vst1q_u64(reinterpret_cast<uint64_t *>(block), x);
+    return crcSlice8(p, iSize, crcSlice8(block, 16, 0));
+}
+
+static bool hasClmul()
+{
+    return getauxval(AT_HWCAP) & HWCAP_PMULL;
+}
+
+#else
+
+static quint16 crcClmul(const char *p, int iSize, quint16 crc)
+{
+    return crcSlice8(p, iSize, crc);
+}
+
+static bool hasClmul()
+{
+    return false;
+}
+
+#endif
+
+/*** dispatch ***/
+
+typedef quint16 (*CrcFunction)(const char *, int, quint16);
+
+static const CrcFunction kFunctions[Crc16::eEngineCount] = {crcBitwise, crcTable, crcSlice8, crcClmul};
+
+static Crc16::Engine pickEngine()
+{
+    return hasClmul() ? Crc16::eClmul : Crc16::eSlice8;
+}
+
+static const Crc16::Engine s_engine = pickEngine();
+
+quint16 Crc16::modbus(const char *p, int iSize)
+{
+    return kFunctions[s_engine](p, iSize, 0xFFFF);
+}
+
+quint16 Crc16::compute(Engine engine, const char *p, int iSize, quint16 crc)
+{
+    if (!isSupported(engine))
+        engine = eSlice8;
+    return kFunctions[engine](p, iSize, crc);
+}
+
+bool Crc16::isSupported(Engine engine)
+{
+    switch (engine) {
+        case eBitwise:
+        case eTable:
+        case eSlice8:
+            return true;
+        case eClmul:
+            return hasClmul();
+        default:
+            return false;
+        }
+}
+
+Crc16::Engine Crc16::engine()
+{
+    return s_engine;
+}
+
+const char *Crc16::name(Engine engine)
+{
+    switch (engine) {
+        case eBitwise: return "bitwise";
+        case eTable:   return "table";
+        case eSlice8:  return "slice8";
+        case eClmul:   return "clmul";
+        default:       return "?";
+        }
+}
@@ -0,0 +1,34 @@
+/****************************************************************************
+**
+** Crc16
+**
+**  CRC-16/MODBUS (poly 0x8005 reflected, init 0xFFFF) with one engine per
+**  speed class: bitwise reference, 256-entry table, slicing-by-8 and a
+**  carry-less multiply fold (PCLMULQDQ on x86, PMULL on ARMv8 crypto).
+**  modbus() picks the fastest one the CPU has once at startup; the fold
+**  only pays off from a few dozen bytes, shorter buffers go to slicing-
+**  by-8. jcModbusBench --crc checks every engine against the reference
+**  and times them.
+**
+****************************************************************************/
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <QtGlobal>
+
+class Crc16
+{
+public:
+    enum Engine { eBitwise, eTable, eSlice8, eClmul, eEngineCount };
+
+    //the frame check of an RTU ADU, low byte first on the wire
+    static quint16 modbus(const char *p, int iSize);
+    static quint16 compute(Engine engine, const char *p, int iSize, quint16 crc = 0xFFFF);
+
+    static bool isSupported(Engine engine);
+    static Engine engine();     //what modbus() runs on this CPU
+    static const char *name(Engine engine);
+};
+
+#endif // CRC16_H
@@ -0,0 +1,202 @@
+#include "datalogger.h"
+
+#include <QDateTime>
+#include <QModbusDataUnit>
+#include <QTextStream>
+#include <QtEndian>
+#include <QDebug>
+#include <chrono>
+
+static const char kMagic[] = "JCMLOG1\n";
+static const int kMagicSize = 8;
+static const int kBlockBytes = 64*1024;
+static const int kFlushMs = 1000;
+static const int kHeaderBytes = 14;     //time, slave, type, address, count
+
+DataLogger::DataLogger(QObject *parent)
+    : QThread(parent)
+{
+}
+
+DataLogger::~DataLogger()
+{
+    close();
+}
+
+//end of the last complete block, a run that died mid-block leaves a torn tail
+static qint64 endOfBlocks(QFile &file)
+{
+    const qint64 llSize = file.size();
+    qint64 llPos = kMagicSize;
+    while (llPos + 4 <= llSize) {
+        uchar size[4];
+        if (!file.seek(llPos) || (file.read(reinterpret_cast<char *>(size), 4) != 4))
+            break;
+        const quint32 uSize = qFromLittleEndian<quint32>(size);
+        if ((uSize == 0) || (llPos + 4 + uSize > llSize))
+            break;
+        llPos += 4 + uSize;
+        }
+    return llPos;
+}
+
+//appends to an existing log behind its last complete block, a new or empty file gets the header
+bool DataLogger::open(const QString &sFilename, QString &sError)
+{
+    close();
+    m_file.setFileName(sFilename);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        sError = m_file.errorString();
+        return false;
+        }
+    if (m_file.size() == 0) {
+        m_file.write(kMagic, kMagicSize);
+        }
+    else if (m_file.read(kMagicSize) != QByteArray(kMagic, kMagicSize)) {
+        sError = tr("%1 is not a data log").arg(sFilename);
+        m_file.close();
+        return false;
+        }
+    else {
+        const qint64 llEnd = endOfBlocks(m_file);
+        if (llEnd < m_file.size()) {
+            qWarning() << "Data log: dropping" << m_file.size() - llEnd << "bytes of a torn block";
+            if (!m_file.resize(llEnd)) {
+                sError = m_file.errorString();
+                m_file.close();
+                return false;
+                }
+            }
+        }
+    m_file.seek(m_file.size());
+
+    m_bStop = false;
+    m_llRecords = 0;
+    m_front.reserve(kBlockBytes + 512);
+    m_bOpen = true;
+    start(QThread::LowPriority);
+    return true;
+}
+
+void DataLogger::close()
+{
+    if (!m_bOpen)
+        return;
+    m_bOpen = false;
+    {
+        QMutexLocker lock(&m_mutex);
+        m_bStop = true;
+        m_wake.wakeOne();
+    }
+    wait();
+    //anything recorded after the writer's last swap
+    if (!m_front.isEmpty())
+        writeBlock(m_front);
+    m_front.clear();
+    m_file.close();
+}
+
+void DataLogger::record(int slave, const QModbusDataUnit &unit)
+{
+    if (!m_bOpen)
+        return;
+
+    const qint64 llTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    const int iCount = qMin(static_cast<int>(unit.valueCount()), unit.values().size());
+    uchar header[kHeaderBytes];
+    qToLittleEndian<qint64>(llTimeUs, header);
+    header[8] = static_cast<uchar>(slave);
+    header[9] = static_cast<uchar>(unit.registerType());
+    qToLittleEndian<quint16>(static_cast<quint16>(unit.startAddress()), header + 10);
+    qToLittleEndian<quint16>(static_cast<quint16>(iCount), header + 12);
+
+    QMutexLocker lock(&m_mutex);
+    m_front.append(reinterpret_cast<const char *>(header), kHeaderBytes);
+    for (int i = 0; i < iCount; i++) {
+        uchar value[2];
+        qToLittleEndian<quint16>(unit.value(i), value);
+        m_front.append(reinterpret_cast<const char *>(value), 2);
+        }
+    m_llRecords++;
+    if (m_front.size() >= kBlockBytes)
+        m_wake.wakeOne();
+}
+
+//writer thread: swap buffers under the lock, compress and write outside it
+void DataLogger::run()
+{
+    QByteArray back;
+    back.reserve(kBlockBytes + 512);
+    QMutexLocker lock(&m_mutex);
+    forever {
+        if (!m_bStop && (m_front.size() < kBlockBytes))
+            m_wake.wait(&m_mutex, kFlushMs);
+        back.swap(m_front);
+        const bool bStop = m_bStop;
+        lock.unlock();
+
+        if (!back.isEmpty()) {
+            writeBlock(back);
+            back.resize(0);
+            }
+        if (bStop)
+            return;
+        lock.relock();
+        }
+}
+
+void DataLogger::writeBlock(const QByteArray &raw)
+{
+    const QByteArray block = qCompress(raw, 1);  //fast level, the disk is rarely the limit
+    uchar size[4];
+    qToLittleEndian<quint32>(static_cast<quint32>(block.size()), size);
+    if ((m_file.write(reinterpret_cast<const char *>(size), 4) != 4)
+            || (m_file.write(block) != block.size()))
+        qWarning() << "Data log write failed:" << m_file.errorString();
+    m_file.flush();
+}
+
+bool DataLogger::exportCSV(const QString &sFilename, QTextStream &out, QString &sError)
+{
+    QFile file(sFilename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        sError = file.errorString();
+        return false;
+        }
+    if (file.read(kMagicSize) != QByteArray(kMagic, kMagicSize)) {
+        sError = tr("%1 is not a data log").arg(sFilename);
+        return false;
+        }
+
+    static const char *kTypes[] = {"-", "DI", "CO", "IR", "HR"};
+    out << "time,slave,type,address,values\n";
+    while (!file.atEnd()) {
+        QByteArray size = file.read(4);
+        if (size.size() < 4)
+            break;  //torn tail of a log that was still being written
+        const quint32 uSize = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(size.constData()));
+        const QByteArray raw = qUncompress(file.read(uSize));
+        const uchar *p = reinterpret_cast<const uchar *>(raw.constData());
+        const uchar *pEnd = p + raw.size();
+        while (pEnd - p >= kHeaderBytes) {
+            const qint64 llTimeUs = qFromLittleEndian<qint64>(p);
+            const int slave = p[8];
+            const int type = p[9];
+            const int iAddr = qFromLittleEndian<quint16>(p + 10);
+            const int iCount = qFromLittleEndian<quint16>(p + 12);
+            p += kHeaderBytes;
+            if (pEnd - p < 2*iCount)
+                break;
+            out << QDateTime::fromMSecsSinceEpoch(llTimeUs/1000).toString("yyyy-MM-dd hh:mm:ss.zzz")
+                << QString("%1").arg(llTimeUs%1000, 3, 10, QChar('0'))
+                << "," << slave << "," << kTypes[(type >= 0) && (type <= 4) ? type : 0]
+                << "," << QString::asprintf("0x%04X", iAddr);
+            for (int i = 0; i < iCount; i++, p += 2)
+                out << "," << QString::asprintf("%04X", qFromLittleEndian<quint16>(p));
+            out << "\n";
+            }
+        }
+    out.flush();
+    return true;
+}
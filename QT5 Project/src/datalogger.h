@@ -0,0 +1,69 @@
+/****************************************************************************
+**
+** DataLogger
+**
+**  Append-only binary log of reply values for long full-rate captures.
+**  record() only appends to the front buffer under a short lock; the
+**  writer thread swaps it for its empty back buffer, compresses the block
+**  and writes it, so a slow disk never stalls the Modbus thread and no
+**  sample is dropped. Blocks go out at kBlockBytes or once a second.
+**  Reopening a log cuts off a block torn by a crash before appending.
+**
+**  File:   "JCMLOG1\n", then blocks of
+**            u32 compressed size, qCompress(records)
+**  Record: i64 time (us since epoch), u8 slave, u8 register type,
+**          u16 address, u16 count, count x u16 value      (little endian)
+**
+****************************************************************************/
+
+#ifndef DATALOGGER_H
+#define DATALOGGER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+
+QT_BEGIN_NAMESPACE
+class QModbusDataUnit;
+class QTextStream;
+QT_END_NAMESPACE
+
+class DataLogger : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit DataLogger(QObject *parent = nullptr);
+    ~DataLogger();
+
+    bool open(const QString &sFilename, QString &sError);
+    void close();
+    bool isOpen() const { return m_bOpen; }
+    qint64 records() const { return m_llRecords; }
+
+    //any thread
+    void record(int slave, const QModbusDataUnit &unit);
+
+    //one "time,slave,type,address,values..." line per record
+    static bool exportCSV(const QString &sFilename, QTextStream &out, QString &sError);
+
+protected:
+    void run() override;
+
+private:
+    void writeBlock(const QByteArray &raw);
+
+    QFile m_file;
+    std::atomic<bool> m_bOpen{false};
+    std::atomic<qint64> m_llRecords{0};
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QByteArray m_front;     //guarded by m_mutex
+    bool m_bStop = false;   //guarded by m_mutex
+};
+
+#endif // DATALOGGER_H
@@ -14,6 +14,7 @@ SOURCES += main.cpp\
         settingsdialog.cpp \
         writeregistermodel.cpp \
         tablemodel.cpp \
+        consolemodel.cpp \
         mainwindow_csv.cpp
 unix:!macx {
     SOURCES +=  rpiCpuSerial.cpp
@@ -22,7 +23,10 @@ unix:!macx {
 HEADERS  += mainwindow.h \
         settingsdialog.h \
         writeregistermodel.h \
-        tablemodel.h
+        tablemodel.h \
+        consolemodel.h
+
+include(modbuscore.pri)
 
 FORMS    += mainwindow.ui \
          settingsdialog.ui
@@ -14,11 +14,17 @@
 #include "ui_mainwindow.h"
 #include "settingsdialog.h"
 #include "writeregistermodel.h"
+#include "modbusworker.h"
+#ifdef MODBUS_RTU_DIRECT
+#include "bussniffer.h"
+#endif
 
-#include <QModbusTcpClient>
-#include <QModbusRtuSerialMaster>
+#include <QInputDialog>
 #include <QStandardItemModel>
 #include <QStatusBar>
+#include <QScrollBar>
+#include <QFileDialog>
+#include <QTextStream>
 #include <QUrl>
 #include <QLoggingCategory>
 #include "settingsdialog.h"
@@ -26,7 +32,8 @@
 enum ModbusConnection {
     eModbusSerial,
     eModbusUSB,
-    eModbusTcp
+    eModbusTcp,
+    eModbusDirect   //RTU on the tty without QSerialPort, see RtuDirectMaster
 };
 
 extern uint32_t rpiSerial();
@@ -35,13 +42,39 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , lastRequest(nullptr)
-    , modbusDevice(nullptr)
+    , m_pWorker(new ModbusWorker)
 {
     ui->setupUi(this);
     this->setWindowTitle("Modbus Master/Client");
 
     m_settingsDialog = new SettingsDialog(this);
 
+    //console, follows the newest line unless scrolled up
+    m_pConsole = new ConsoleModel(default_console_lines, this);
+    ui->listConsole->setModel(m_pConsole);
+    connect(m_pConsole, &QAbstractItemModel::rowsAboutToBeInserted, this, [this]() {
+        QScrollBar *pBar = ui->listConsole->verticalScrollBar();
+        m_bConsoleFollow = (pBar->value() == pBar->maximum());
+        });
+    connect(m_pConsole, &QAbstractItemModel::rowsInserted, this, [this]() {
+        if (m_bConsoleFollow)
+            ui->listConsole->scrollToBottom();
+        });
+
+    //Modbus client and script executor run on their own thread
+    m_pWorker->moveToThread(&m_threadModbus);
+    connect(&m_threadModbus, &QThread::finished, m_pWorker, &QObject::deleteLater);
+    m_threadModbus.setObjectName("modbus");
+    m_threadModbus.start(QThread::HighPriority);
+    ModbusWorker *pWorker = m_pWorker;
+    QMetaObject::invokeMethod(pWorker, [pWorker]() { pWorker->startStatsServer(default_stats_socket); }, Qt::QueuedConnection);
+
+    //stats panel, the same text the socket serves
+    connect(&m_timerStats, &QTimer::timeout, this, [this]() {
+        ui->plainTextStats->setPlainText(m_pWorker->stats()->report());
+        });
+    m_timerStats.start(1000);
+
     initActions();
 
     on_connectType_currentIndexChanged(eModbusSerial);
@@ -67,9 +100,9 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
-    if (modbusDevice)
-        modbusDevice->disconnectDevice();
-    delete modbusDevice;
+    //worker disconnects and deletes the client on its own thread
+    m_threadModbus.quit();
+    m_threadModbus.wait();
 
     delete ui;
 }
@@ -89,27 +122,91 @@ void MainWindow::initActions()
     connect(ui->actionExit, &QAction::triggered, this, &QMainWindow::close);
     connect(ui->actionOptions, &QAction::triggered, m_settingsDialog, &QDialog::show);
 
-    connect(this, SIGNAL(sigModbusCmd(int,int,int)), this, SLOT(slotModbusCmd(int,int,int)) );
+    //data log of every good reply, written on its own thread
+    connect(ui->actionLog, &QAction::triggered, this, [this](bool bChecked) {
+        ModbusWorker *pWorker = m_pWorker;
+        if (!bChecked) {
+            QMetaObject::invokeMethod(pWorker, [pWorker]() { pWorker->stopLog(); }, Qt::QueuedConnection);
+            statusBar()->showMessage(tr("Data log closed"), 5000);
+            return;
+            }
+        QString sFile = QFileDialog::getSaveFileName(this, tr("Log replies to"), "replies.jclog",
+                                                     tr("Data log (*.jclog)"), nullptr, QFileDialog::DontConfirmOverwrite);
+        if (sFile.isEmpty()) {
+            ui->actionLog->setChecked(false);
+            return;
+            }
+        QMetaObject::invokeMethod(pWorker, [pWorker, sFile]() { pWorker->startLog(sFile); }, Qt::QueuedConnection);
+        statusBar()->showMessage(tr("Logging to %1").arg(sFile), 5000);
+        });
+    connect(ui->actionExportLog, &QAction::triggered, this, [this]() {
+        QString sLog = QFileDialog::getOpenFileName(this, tr("Data log"), QString(), tr("Data log (*.jclog)"));
+        if (sLog.isEmpty())
+            return;
+        QString sCsv = QFileDialog::getSaveFileName(this, tr("Export to"), sLog + ".csv", tr("CSV (*.csv)"));
+        if (sCsv.isEmpty())
+            return;
+        QFile file(sCsv);
+        QString sError;
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            sError = file.errorString();
+            }
+        else {
+            QTextStream out(&file);
+            DataLogger::exportCSV(sLog, out, sError);
+            }
+        statusBar()->showMessage(sError.isEmpty() ? tr("Exported %1").arg(sCsv) : sError, 5000);
+        });
+
+    //passive listener on a second RS-485 adapter, its frames go to the console
+#ifdef MODBUS_RTU_DIRECT
+    m_pSniffer = new BusSniffer(this);
+    connect(m_pSniffer, &BusSniffer::framesPending, this, &MainWindow::slotSnifferFrames);
+    connect(ui->actionSniff, &QAction::triggered, this, [this](bool bChecked) {
+        if (!bChecked) {
+            m_pSniffer->close();
+            m_pConsole->append(tr("Sniffer stopped, %1 frames").arg(m_pSniffer->frames()));
+            return;
+            }
+        bool bOk = false;
+        const QString sPort = QInputDialog::getText(this, tr("Sniff bus"), tr("Port:"), QLineEdit::Normal,
+                                                    QLatin1Literal(default_USBport), &bOk);
+        QString sError;
+        if (!bOk || sPort.isEmpty() || !m_pSniffer->open(sPort, m_settingsDialog->settings(), sError)) {
+            ui->actionSniff->setChecked(false);
+            if (!sError.isEmpty())
+                statusBar()->showMessage(tr("Sniff %1: %2").arg(sPort, sError), 5000);
+            return;
+            }
+        m_pConsole->append(tr("Sniffing %1").arg(sPort));
+        });
+#else
+    ui->actionSniff->setVisible(false);
+#endif
+
     connect(this, SIGNAL(sigModbusRegRead(int, quint16)), this, SLOT(slotModbusRegRead(int, quint16)) );
     connect(this, SIGNAL(sigModbusRegsWrite(int, QVector<quint16>)), this, SLOT(slotModbusRegsWrite(int, QVector<quint16>))) ;
+    connect(this, SIGNAL(sigModbusRegsReadWrite(int, quint16, int, QVector<quint16>)), this, SLOT(slotModbusRegsReadWrite(int, quint16, int, QVector<quint16>))) ;
     connect(this, SIGNAL(sigModbusCoilRead(int, quint16)), this, SLOT(slotModbusCoilRead(int, quint16)) );
     connect(this, SIGNAL(sigModbusCoilWrite(int, QVector<quint16>)), this, SLOT(slotModbusCoilWrite(int, QVector<quint16>))) ;
 
+    connect(m_pWorker, &ModbusWorker::eventsPending, this, &MainWindow::slotModbusEvents);
+    connect(m_pWorker, &ModbusWorker::stateChanged, this, &MainWindow::onStateChanged);
+    connect(m_pWorker, &ModbusWorker::errorOccurred, this, [this](const QString &sError) {
+        statusBar()->showMessage(sError, 5000);
+        });
 }
 
 void MainWindow::on_connectType_currentIndexChanged(int index)
 {
     qDebug() << __FUNCTION__ << index;
 
-    if (modbusDevice) {
-        modbusDevice->disconnectDevice();
-        delete modbusDevice;
-        modbusDevice = nullptr;
-        }
-
     auto type = static_cast<ModbusConnection> (index);
+    ModbusWorker *pWorker = m_pWorker;
+    int transport = (type == eModbusTcp) ? eTransportTcp : (type == eModbusDirect) ? eTransportRtuDirect : eTransportRtu;
+    QMetaObject::invokeMethod(pWorker, [pWorker, transport]() { pWorker->createDevice(transport); }, Qt::QueuedConnection);
+
     if (type == eModbusSerial) {
-        modbusDevice = new QModbusRtuSerialMaster(this);
         //rescan serial port list
         const auto infos = QSerialPortInfo::availablePorts();
         if (infos.length() == 0) {
@@ -125,7 +222,6 @@ void MainWindow::on_connectType_currentIndexChanged(int index)
 
         ui->labelPort->setText("RPi Serial RTU");
     } else if (type == eModbusUSB) { //USB to Serial
-        modbusDevice = new QModbusRtuSerialMaster(this);
         //rescan serial port list
         const auto infos = QSerialPortInfo::availablePorts();
         if (infos.length() == 0) {
@@ -141,118 +237,61 @@ void MainWindow::on_connectType_currentIndexChanged(int index)
 
         ui->labelPort->setText("RPi USB2Serial RTU");
 
+    } else if (type == eModbusDirect) {
+        qDebug() << ui->connectType->currentText();
+        ui->portEdit->setText(QLatin1Literal(default_serialport));
+        ui->labelPort->setText("Direct RTU (termios)");
+
     } else if (type == eModbusTcp) {
-        modbusDevice = new QModbusTcpClient(this);
         //if (ui->portEdit->text().isEmpty())
         qDebug() << ui->connectType->currentText();
         ui->portEdit->setText(QLatin1Literal(default_modebus_ip));
         ui->labelPort->setText("Generic TCP Modbus");
     }
-
-    connect(modbusDevice, &QModbusClient::errorOccurred, [this](QModbusDevice::Error) {
-        statusBar()->showMessage(modbusDevice->errorString(), 5000);
-        });
-
-    if (!modbusDevice) {
-        ui->connectButton->setDisabled(true);
-        if (type == eModbusSerial)
-            statusBar()->showMessage(tr("Could not create Modbus RTU"), 5000);
-        else
-            statusBar()->showMessage(tr("Could not create Modbus TCP"), 5000);
-    } else {
-        connect(modbusDevice, &QModbusClient::stateChanged,
-                this, &MainWindow::onStateChanged);
-        }
 }
 
 void MainWindow::on_connectButton_clicked()
 {
-    if (!modbusDevice)
-        return;
-
     statusBar()->clearMessage();
-    if (modbusDevice->state() != QModbusDevice::ConnectedState) {
+    ModbusWorker *pWorker = m_pWorker;
+    if (m_iModbusState != QModbusDevice::ConnectedState) {
         qDebug() << __FUNCTION__ << ui->portEdit->text();
         qDebug() << "("<<m_settingsDialog->settings().parity << m_settingsDialog->settings().baud << m_settingsDialog->settings().dataBits << m_settingsDialog->settings().stopBits << ")";
 
-        if ( (static_cast<ModbusConnection> (ui->connectType->currentIndex()) == eModbusSerial) ||
-             (static_cast<ModbusConnection> (ui->connectType->currentIndex()) == eModbusUSB) ){
-            modbusDevice->setConnectionParameter(QModbusDevice::SerialPortNameParameter,ui->portEdit->text());
-            modbusDevice->setConnectionParameter(QModbusDevice::SerialParityParameter,  m_settingsDialog->settings().parity);
-            modbusDevice->setConnectionParameter(QModbusDevice::SerialBaudRateParameter,m_settingsDialog->settings().baud);
-            modbusDevice->setConnectionParameter(QModbusDevice::SerialDataBitsParameter,m_settingsDialog->settings().dataBits);
-            modbusDevice->setConnectionParameter(QModbusDevice::SerialStopBitsParameter,m_settingsDialog->settings().stopBits);
-        } else {
-            const QUrl url = QUrl::fromUserInput(ui->portEdit->text());
-            modbusDevice->setConnectionParameter(QModbusDevice::NetworkPortParameter, url.port());
-            modbusDevice->setConnectionParameter(QModbusDevice::NetworkAddressParameter, url.host());
-            }
-        modbusDevice->setTimeout(m_settingsDialog->settings().responseTime);
-        modbusDevice->setNumberOfRetries(m_settingsDialog->settings().numberOfRetries);
-        qDebug() << m_settingsDialog->settings().responseTime << m_settingsDialog->settings().numberOfRetries;
-        if (!modbusDevice->connectDevice()) {
-            statusBar()->showMessage(tr("Connect failed: ") + modbusDevice->errorString(), 5000);
-        } else {
-            ui->actionConnect->setEnabled(false);
-            ui->actionDisconnect->setEnabled(true);
-            }
+        const QString sPort = ui->portEdit->text();
+        const ModbusSettings settings = m_settingsDialog->settings();
+        QMetaObject::invokeMethod(pWorker, [pWorker, sPort, settings]() { pWorker->connectDevice(sPort, settings); }, Qt::QueuedConnection);
     } else {
-        modbusDevice->disconnectDevice();
-        ui->actionConnect->setEnabled(true);
-        ui->actionDisconnect->setEnabled(false);
+        QMetaObject::invokeMethod(pWorker, [pWorker]() { pWorker->disconnectDevice(); }, Qt::QueuedConnection);
         }
 }
 
 void MainWindow::onStateChanged(int state)
 {
+    m_iModbusState = state;
     bool connected = (state != QModbusDevice::UnconnectedState);
     ui->actionConnect->setEnabled(!connected);
     ui->actionDisconnect->setEnabled(connected);
 
     if (state == QModbusDevice::UnconnectedState) {
         ui->connectButton->setText(tr("Connect"));
-        ui->plainTextConsole->setEnabled(false);
+        ui->listConsole->setEnabled(false);
         ui->btnRun->setEnabled(false);
         }
     else if (state == QModbusDevice::ConnectedState) {
         ui->connectButton->setText(tr("Disconnect"));
-        ui->plainTextConsole->setEnabled(true);
+        ui->listConsole->setEnabled(true);
         ui->btnRun->setEnabled(true);
         }
 }
 
-void MainWindow::readReady()
+void MainWindow::showReply(const ModbusEvent &ev)
 {
-    auto reply = qobject_cast<QModbusReply *>(sender());
-    if (!reply) return;
-qDebug() << __FUNCTION__ << reply->rawResult();
-    if (reply->error() == QModbusDevice::NoError) {
-        const QModbusDataUnit unit = reply->result();
-        int iCounts = static_cast<int>(unit.valueCount());
-        char buf[32];
-        sprintf(buf, "<0x%04X:|", unit.startAddress());
-        QString sData = QString(buf);
-        QString sString="(";
-        for (int i = 0; i < iCounts; i++) {
-            sprintf(buf, "%04X|",  unit.value(i));
-            sData += QString(buf);
-            char c1 =  (unit.value(i)&0xFF00)>>8;
-            char c2 =  (unit.value(i)&0x00FF);
-            sString += isprint(c1)?QString(QChar::fromLatin1(c1)):".";
-            sString += isprint(c2)?QString(QChar::fromLatin1(c2)):".";
-            }
-        sString += ")";
-
-        QTextCharFormat tf;
-        tf = ui->plainTextConsole->currentCharFormat();
-        tf.setForeground(QBrush(QColor("blue")));
-        ui->plainTextConsole->setCurrentCharFormat(tf);
-
-        ui->plainTextConsole->appendPlainText(sData+sString);
-        ui->lineEditModbusData->setText(sData);
-
-        tf.setForeground(QBrush(QColor("black")));
-        ui->plainTextConsole->setCurrentCharFormat(tf);
+qDebug() << __FUNCTION__ << ev.unit.values();
+    if (ev.error == QModbusDevice::NoError) {
+        QString sReply = ModbusScript::formatUnit(ev.unit);
+        m_pConsole->append(ev.sText.isEmpty() ? sReply : sReply + " " + ev.sText, ConsoleRecord::eReply);
+        ui->lineEditModbusData->setText(sReply.left(sReply.indexOf('(')));
 
         ui->btnSend->setEnabled(false);
         mModbusErr = 0;
@@ -269,178 +308,63 @@ qDebug() << __FUNCTION__ << reply->rawResult();
                    break;
                    }
                 } */
-    } else if (reply->error() == QModbusDevice::ProtocolError) {
+    } else if (ev.error == QModbusDevice::ProtocolError) {
         statusBar()->showMessage(tr("Read response error: %1 (Mobus exception: 0x%2)").
-                                    arg(reply->errorString()).
-                                    arg(reply->rawResult().exceptionCode(), -1, 16), 5000);
+                                    arg(ev.sText).
+                                    arg(ev.iException, -1, 16), 5000);
         char buf[64];
-        sprintf(buf, "!!! %s: %02X", reply->errorString().toStdString().c_str(), reply->rawResult().exceptionCode());
-
-        QTextCharFormat tf;
-        tf = ui->plainTextConsole->currentCharFormat();
-        tf.setForeground(QBrush(QColor("magenta")));
-        ui->plainTextConsole->setCurrentCharFormat(tf);
-        ui->plainTextConsole->appendPlainText(QString(buf));
+        sprintf(buf, "!!! %s: %02X", ev.sText.toStdString().c_str(), ev.iException);
+        m_pConsole->append(QString(buf), ConsoleRecord::eException);
 qDebug() << "Except:" << QString(buf);
-        mModbusExcept = reply->rawResult().exceptionCode();
+        mModbusExcept = ev.iException;
     } else {
         statusBar()->showMessage(tr("Read response error: %1 (code: 0x%2)").
-                                    arg(reply->errorString()).
-                                    arg(reply->error(), -1, 16), 5000);
+                                    arg(ev.sText).
+                                    arg(ev.error, -1, 16), 5000);
         char buf[64];
-        sprintf(buf, "Err %s: %02X", reply->errorString().toStdString().c_str(), reply->error());
-
-        QTextCharFormat tf;
-        tf = ui->plainTextConsole->currentCharFormat();
-        tf.setForeground(QBrush(QColor("red")));
-        ui->plainTextConsole->setCurrentCharFormat(tf);
-        ui->plainTextConsole->appendPlainText(QString(buf));
+        sprintf(buf, "Err %s: %02X", ev.sText.toStdString().c_str(), ev.error);
+        m_pConsole->append(QString(buf), ConsoleRecord::eError);
 qDebug() << "Err:" << QString(buf);
-        mModbusErr = reply->error();
+        mModbusErr = ev.error;
         }
-    reply->deleteLater();
-}
-
-void MainWindow::msSleep(uint ms)
-{
-    for (uint i=0; i<ms; i++) {
-        QApplication::processEvents();
-        QThread::msleep(1);
-        }
-
 }
 
 void MainWindow::slotModbusRegRead(int iRegAddr, quint16 iRegCount)
 {
     int iServerAddr = ui->serverEdit->value();
     statusBar()->clearMessage();
-    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, iRegCount);
-    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
-
-    if (auto *reply = modbusDevice->sendReadRequest(du, iServerAddr) ) {
-        if (!reply->isFinished()){
-            connect(reply, &QModbusReply::finished, this, &MainWindow::readReady);
-            }
-        else
-            delete reply; // broadcast replies return immediately
-    } else {
-        statusBar()->showMessage(tr("Read error: ") + modbusDevice->errorString(), 5000);
-        }
+    ModbusWorker *pWorker = m_pWorker;
+    QMetaObject::invokeMethod(pWorker, [=]() { pWorker->regRead(iServerAddr, iRegAddr, iRegCount); }, Qt::QueuedConnection);
 }
 void MainWindow::slotModbusRegsWrite(int iRegAddr, QVector<quint16> data)
 {
     int iServerAddr = ui->serverEdit->value();
     statusBar()->clearMessage();
-//qDebug() << "slotRegsW" << data << data.size();
-    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, data);
-    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
-    if (auto *reply = modbusDevice->sendWriteRequest(du, iServerAddr) ) {
-        qApp->exec();
-        if (!reply->isFinished())
-            connect(reply, &QModbusReply::finished, this, &MainWindow::readReady);
-        else
-            delete reply; // broadcast replies return immediately
-    } else {
-        statusBar()->showMessage(tr("Read error: ") + modbusDevice->errorString(), 5000);
-    }
+    ModbusWorker *pWorker = m_pWorker;
+    QMetaObject::invokeMethod(pWorker, [=]() { pWorker->regsWrite(iServerAddr, iRegAddr, data); }, Qt::QueuedConnection);
 }
-
-void MainWindow::slotModbusCoilWrite(int iCoilAddr, QVector<quint16> data)
+void MainWindow::slotModbusRegsReadWrite(int iReadAddr, quint16 iReadCount, int iWriteAddr, QVector<quint16> data)
 {
     int iServerAddr = ui->serverEdit->value();
     statusBar()->clearMessage();
-//qDebug() << "slotRegsW" << data << data.size();
-    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::Coils, iCoilAddr, data);
-    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
-    if (auto *reply = modbusDevice->sendWriteRequest(du, iServerAddr) ) {
-        qApp->exec();
-        if (!reply->isFinished())
-            connect(reply, &QModbusReply::finished, this, &MainWindow::readReady);
-        else
-            delete reply; // broadcast replies return immediately
-    } else {
-        statusBar()->showMessage(tr("Read error: ") + modbusDevice->errorString(), 5000);
-    }
+    ModbusWorker *pWorker = m_pWorker;
+    QMetaObject::invokeMethod(pWorker, [=]() { pWorker->regsReadWrite(iServerAddr, iReadAddr, iReadCount, iWriteAddr, data); }, Qt::QueuedConnection);
 }
 
-void MainWindow::slotModbusCoilRead(int iCoilAddr, quint16 iCoilCount)
+void MainWindow::slotModbusCoilWrite(int iCoilAddr, QVector<quint16> data)
 {
     int iServerAddr = ui->serverEdit->value();
     statusBar()->clearMessage();
-    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::DiscreteInputs, iCoilAddr, iCoilCount);
-    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
-
-    if (auto *reply = modbusDevice->sendReadRequest(du, iServerAddr) ) {
-        if (!reply->isFinished()){
-            connect(reply, &QModbusReply::finished, this, &MainWindow::readReady);
-            }
-        else
-            delete reply; // broadcast replies return immediately
-    } else {
-        statusBar()->showMessage(tr("Read error: ") + modbusDevice->errorString(), 5000);
-        }
+    ModbusWorker *pWorker = m_pWorker;
+    QMetaObject::invokeMethod(pWorker, [=]() { pWorker->coilWrite(iServerAddr, iCoilAddr, data); }, Qt::QueuedConnection);
 }
 
-void MainWindow::slotModbusCmd(int row, int iWAIT, int iLOOP)
+void MainWindow::slotModbusCoilRead(int iCoilAddr, quint16 iCoilCount)
 {
-    QList<QStringList> listCmds = pModelCSV->getStringLists();
-    if (QVariant(listCmds[row][enumModbusCSV::eActRun]).toBool()) {
-
-        ui->tableViewModbus->selectRow(row);
-        ui->plainTextConsole->appendPlainText("> "+QString::number(row)+" "+listCmds[row][enumModbusCSV::eCategory]+" "+listCmds[row][enumModbusCSV::eDescription]);
-        bool  ok;
-        int iRun    = iLOOP?iLOOP:listCmds[row][enumModbusCSV::eActRun].toInt(&ok, 10);
-        if (iRun == 0) return;
-
-        int iRegAddr= listCmds[row][enumModbusCSV::eReg].toInt(&ok, 16);
-        int  iCount = listCmds[row][enumModbusCSV::eCount].toInt(&ok, 10);
-        QString sRW = listCmds[row][enumModbusCSV::eRW].toLocal8Bit();
-        int iValue  = listCmds[row][enumModbusCSV::eValue].toInt(&ok, 16);
-        int iWait   = iWAIT?iWAIT:listCmds[row][enumModbusCSV::eWait].toInt(&ok, 10);
-        int iLoop   = iLOOP?iLOOP:listCmds[row][enumModbusCSV::eLoop].toInt(&ok, 10);
-        char buf[128];
-        for (int l=0;l<iLoop;l++) {
-            if (sRW.contains("Rc",Qt::CaseInsensitive) ) { //Read coil
-                if (!isDryRun) emit sigModbusCoilRead(iRegAddr, static_cast<quint16>(iCount));
-                sprintf(buf, "  %s %d @0x%04X ", sRW.toStdString().c_str(), iCount, iRegAddr);
-                ui->plainTextConsole->appendPlainText(buf);
-                msSleep(static_cast<uint>(iWait));
-                }
-            if (sRW.contains("Rr",Qt::CaseInsensitive) ) { //Read regs
-                if (!isDryRun) emit sigModbusRegRead(iRegAddr, static_cast<quint16>(iCount));
-                sprintf(buf, "  %s %d @0x%04X ", sRW.toStdString().c_str(), iCount, iRegAddr);
-                ui->plainTextConsole->appendPlainText(buf);
-                msSleep(static_cast<uint>(iWait));
-                }
-            if (sRW.contains("Wc", Qt::CaseInsensitive) ) { //Write single ccoil
-                QVector<quint16> data;
-                data.resize(1);
-                data[0] = static_cast<quint16>(iValue);
-
-                if (!isDryRun) emit sigModbusCoilWrite(iRegAddr, data);
-                sprintf(buf, "  %s @0x%X >0x%04X ", sRW.toStdString().c_str(), iRegAddr, iValue);
-                ui->plainTextConsole->appendPlainText(buf);
-                msSleep(static_cast<uint>(iWait));
-                }
-            if (sRW.contains("Wr", Qt::CaseInsensitive) ) { //Write regs
-                QVector<quint16> data;
-                if (iCount==1) {
-                    data.resize(1);
-                    data[0] = static_cast<quint16>(iValue);
-                    }
-                else{
-                    data.resize(2);
-                    data[0] = static_cast<quint16>(iValue>>16);
-                    data[1] = iValue&0x0FFFF;
-                    }
-                if (!isDryRun) emit sigModbusRegsWrite(iRegAddr, data);
-                sprintf(buf, "  %s %d @0x%X >0x%04X ", sRW.toStdString().c_str(), iCount, iRegAddr, iValue);
-                ui->plainTextConsole->appendPlainText(buf);
-                msSleep(static_cast<uint>(iWait));
-                }
-            }
-        //msSleep(100); //for displaying selection
-        }
+    int iServerAddr = ui->serverEdit->value();
+    statusBar()->clearMessage();
+    ModbusWorker *pWorker = m_pWorker;
+    QMetaObject::invokeMethod(pWorker, [=]() { pWorker->coilRead(iServerAddr, iCoilAddr, iCoilCount); }, Qt::QueuedConnection);
 }
 
 void MainWindow::on_btnSend_clicked()
@@ -484,6 +408,17 @@ void MainWindow::on_btnSend_clicked()
             qDebug() << iFC<< iReg<< iCount<< data;
             emit sigModbusRegsWrite(iReg, data);
             break;
+        case 23:    //read reg, read count, write reg, write count, data
+            if (slDU.size() < 6)
+                break;
+            data.resize(slDU[5].toInt());
+            for (int i=0;i<data.size();i++) {
+                iValue= slDU.value(6+i).toInt(&ok,16);
+                data[i]=static_cast<quint16>(iValue);
+                }
+            qDebug() << iFC<< iReg<< iCount<< data;
+            emit sigModbusRegsReadWrite(iReg, static_cast<quint16>(iCount), slDU[4].toInt(&ok,16), data);
+            break;
             }
 
 }
@@ -491,106 +426,133 @@ void MainWindow::on_btnSend_clicked()
 
 void MainWindow::on_btnRun_clicked()
 {
-static bool bRun=false;
+    runScript(false);
+}
 
-    bRun = !bRun;
-    if (bRun)
-        ui->btnRun->setText("Stop");
+void MainWindow::on_btnDryRun_clicked()
+{
+    runScript(true);
+}
+
+void MainWindow::on_btnStatsReset_clicked()
+{
+    m_pWorker->stats()->reset();
+    ui->plainTextStats->setPlainText(m_pWorker->stats()->report());
+}
+
+void MainWindow::runScript(bool bDryRun)
+{
+    ModbusWorker *pWorker = m_pWorker;
+    if (m_bScriptRunning) {
+        QMetaObject::invokeMethod(pWorker, [pWorker]() { pWorker->stopScript(); }, Qt::QueuedConnection);
+        return;
+        }
+
+    m_bScriptRunning = true;
+    isDryRun = bDryRun;
+    if (bDryRun)
+        ui->btnDryRun->setText("Stop");
     else
-        ui->btnRun->setText("Run");
+        ui->btnRun->setText("Stop");
 
-    isDryRun = false;
-    int iLoop = ui->spinBoxRunLoop->value();
-    while ((iLoop >0) && bRun) {
-        QDateTime local(QDateTime::currentDateTime());
-        QString sDateTime = local.toString("hh:mm:ss");
-        ui->plainTextConsole->appendPlainText("<"+sDateTime+">"+QString::number(iLoop));
-        for (int r=0; r<ui->tableViewModbus->model()->rowCount(); r++) {
-            QList<QStringList> listCmds = pModelCSV->getStringLists();
-            bool ok;
-            int iRun    = listCmds[r][enumModbusCSV::eActRun].toInt(&ok, 10);
-            if (iRun == 0) { qDebug() << "Skipped row" << r; continue;}
-
-            //loop untill timeout or ready
-            bModbusReplyOK = false;
-            int iTimeout = 0; //1000ms
-
-            while ((iTimeout < 3000) && !bModbusReplyOK && bRun){
-                if ((iTimeout%1000)==0) emit sigModbusCmd(r);
-                msSleep(1);
-                //qApp->exec();
-                iTimeout++;
-                }
-            /*
-            //Modbus run state machine
-            int iRetry=0;
-            int iState=0;
-            while (bRun) {
-                switch (iState) {
-                    case 0: //init
-                        emit sigModbusCmd(r);
-                        iRetry++;
-                        if (iRetry>=3)
-                            iState=9; //stop
-                        else
-                            iState=1; //next state
-                        break;
-                    case 1: //wait modbus write OK or error! or timeout!
-                        msSleep(1);qApp->exec();
-                        iTimeout++;
-                        if (iTimeout>3000)  {iState=9; qDebug()<<"Modbus Timeout!";} //stop
-                        if (bModbusReplyOK) {iState=9; qDebug()<<"Modbus ReplyOK!";}
-                        if (mModbusExcept>0){iState=0; qDebug()<<"Modbus Exception:"<<mModbusExcept;} //retry
-                        if (mModbusErr>0)   {iState=0; qDebug()<<"Modbus Error:"<<mModbusErr;} //stop
-                        break;
-                    case 2:
-                        break; //OK, next
-                    default:
-                    case 9:
-                        bRun=false; //STOP
-                        break;
-                    }
-                }*/
+    const ModbusProgram program = ModbusScript::coalesceWrites(ModbusScript::coalesceReads(m_program, m_settingsDialog->settings().coalesceGap));
+    bool bTcp = (static_cast<ModbusConnection> (ui->connectType->currentIndex()) == eModbusTcp);
+    int iWindow = bTcp ? m_settingsDialog->settings().tcpWindow : 1;
+    int iPollInterval = m_settingsDialog->settings().pollInterval;
+    int iLoops = ui->spinBoxRunLoop->value();
+    int iServerAddr = ui->serverEdit->value();
+    if (ModbusScript::isScheduled(program)) {
+        //rows with a Period poll cyclically until Stop
+        m_pConsole->append(bDryRun ? "< Dry Run schedule >" : "< Schedule >");
+        QMetaObject::invokeMethod(pWorker, [=]() { pWorker->runSchedule(program, iServerAddr, bDryRun); }, Qt::QueuedConnection);
+        return;
+        }
+    QMetaObject::invokeMethod(pWorker, [=]() { pWorker->runScript(program, iLoops, iServerAddr, bDryRun, iWindow, iPollInterval); }, Qt::QueuedConnection);
+}
+
+//Drain everything the worker queued since the last wakeup
+void MainWindow::slotModbusEvents()
+{
+    m_pWorker->clearPending();
+    ModbusEvent ev;
+    while (m_pWorker->popEvent(ev)) {
+        switch (ev.type) {
+            case ModbusEvent::eRowStarted:
+                slotScriptRow(ev.iValue);
+                break;
+            case ModbusEvent::eMessage:
+                m_pConsole->append(ev.sText);
+                break;
+            case ModbusEvent::eReply:
+                showReply(ev);
+                break;
+            case ModbusEvent::eLoopStarted:
+                slotScriptLoopStarted(ev.iValue);
+                break;
+            case ModbusEvent::eLoopFinished:
+                slotScriptLoopFinished(ev.iValue);
+                break;
+            case ModbusEvent::eFinished:
+                slotScriptFinished();
+                break;
             }
-        ui->plainTextConsole->appendPlainText("--------------------");
-        ui->tableViewModbus->selectRow(0);
-        iLoop = iLoop-1;
-        ui->spinBoxRunLoop->setValue(iLoop);
         }
-    bRun=false;
-    ui->btnRun->setText("Run");
-    ui->spinBoxRunLoop->setValue(1);
+    int iDropped = m_pWorker->takeDropped();
+    if (iDropped)
+        m_pConsole->append(QString("!!! %1 console events dropped").arg(iDropped), ConsoleRecord::eError);
 }
 
+void MainWindow::slotSnifferFrames()
+{
+#ifdef MODBUS_RTU_DIRECT
+    m_pSniffer->clearPending();
+    QString sLine;
+    BusSniffer::Kind kind;
+    while (m_pSniffer->nextLine(sLine, kind)) {
+        switch (kind) {
+            case BusSniffer::eRequest:   m_pConsole->append(sLine); break;
+            case BusSniffer::eResponse:  m_pConsole->append(sLine, ConsoleRecord::eReply); break;
+            case BusSniffer::eException: m_pConsole->append(sLine, ConsoleRecord::eException); break;
+            case BusSniffer::eBadFrame:  m_pConsole->append(sLine, ConsoleRecord::eError); break;
+            }
+        }
+    qint64 llDropped = m_pSniffer->takeDropped();
+    if (llDropped)
+        m_pConsole->append(QString("!!! %1 sniffed bytes/frames dropped").arg(llDropped), ConsoleRecord::eError);
+#endif
+}
 
-void MainWindow::on_btnDryRun_clicked()
+void MainWindow::slotScriptRow(int row)
 {
-    static bool bRun=false;
+    ui->tableViewModbus->selectRow(row);
+    QModelIndex idx = pModelCSV->index(row, enumModbusCSV::eCategory);
+    m_pConsole->append("> "+QString::number(row)+" "+idx.data().toString()+" "+
+                       idx.sibling(row, enumModbusCSV::eDescription).data().toString());
+}
 
-    bRun = !bRun;
-    if (bRun)
-       ui->btnDryRun->setText("Stop");
-    else
-       ui->btnDryRun->setText("DryRun");
-
-    isDryRun = true;
-    int iLoop = ui->spinBoxRunLoop->value();
-    while ((iLoop >0) && bRun) {
-        ui->plainTextConsole->appendPlainText("< Dry Run >"+QString::number(iLoop));
-        for (int r=0; r<ui->tableViewModbus->model()->rowCount(); r++) {
-            QList<QStringList> listCmds = pModelCSV->getStringLists();
-            bool ok;
-            int iRun    = listCmds[r][enumModbusCSV::eActRun].toInt(&ok, 10);
-            if (iRun == 0) { qDebug() << "Skipped row" << r; continue;}
-
-            emit sigModbusCmd(r);
-            }
-        ui->plainTextConsole->appendPlainText("--------------------");
-        ui->tableViewModbus->selectRow(0);
-        iLoop = iLoop-1;
-        ui->spinBoxRunLoop->setValue(iLoop);
+void MainWindow::slotScriptLoopStarted(int iLoop)
+{
+    if (isDryRun) {
+        m_pConsole->append("< Dry Run >"+QString::number(iLoop));
+        }
+    else {
+        QDateTime local(QDateTime::currentDateTime());
+        QString sDateTime = local.toString("hh:mm:ss");
+        m_pConsole->append("<"+sDateTime+">"+QString::number(iLoop));
         }
-    bRun=false;
+}
+
+void MainWindow::slotScriptLoopFinished(int iLoopsLeft)
+{
+    m_pConsole->append("--------------------");
+    ui->tableViewModbus->selectRow(0);
+    ui->spinBoxRunLoop->setValue(iLoopsLeft);
+}
+
+void MainWindow::slotScriptFinished()
+{
+    m_bScriptRunning = false;
+    ui->btnRun->setText("Run");
     ui->btnDryRun->setText("DryRun");
     ui->spinBoxRunLoop->setValue(1);
 }
@@ -54,10 +54,13 @@
 #include <QTimer>
 #include <QDirIterator>
 #include "tablemodel.h"
+#include "modbussettings.h"
+#include "modbusscript.h"
+#include "modbusworker.h"
+#include "consolemodel.h"
 
-#define default_modebus_ip "192.168.0.12:502"
-#define default_serialport "/dev/ttyS0"
-#define default_USBport "/dev/ttyUSB0"
+#define default_stats_socket "jcModbusClient-stats"
+#define default_console_lines 10000
 
 QT_BEGIN_NAMESPACE
 
@@ -73,9 +76,7 @@ QT_END_NAMESPACE
 
 class SettingsDialog;
 class WriteRegisterModel;
-
-enum enumModbusCSV {eCategory=0, eDescription, eCount, eReg, eRW, eValue, eWait, eLoop, eActRun};
-
+class BusSniffer;
 
 class MainWindow : public QMainWindow
 {
@@ -84,8 +85,8 @@ class MainWindow : public QMainWindow
 public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
-    void msSleep(uint ms);
     TableModel *pModelCSV;
+    ModbusProgram m_program;
     bool isDryRun=true;
     QModbusDataUnit _DataUnit;
     int mModbusErr=0;
@@ -97,17 +98,17 @@ public:
     QString endHtml   = "</font>";
 
 public slots:
-    void slotModbusCmd(int row, int wait=0, int loop=0);
     void slotModbusRegRead(int iRegAddr, quint16 iRegCount);
     void slotModbusRegsWrite(int iRegAddr, QVector<quint16> data);
+    void slotModbusRegsReadWrite(int iReadAddr, quint16 iReadCount, int iWriteAddr, QVector<quint16> data);
     void slotModbusCoilWrite(int iCoilAddr, QVector<quint16> data);
     void slotModbusCoilRead(int iCoilAddr, quint16 iCoilCount);
 
 
 signals:
-    void sigModbusCmd(int row, int wait=0, int loop=0);
     void sigModbusRegRead(int iRegAddr, quint16 iRegCount);
     void sigModbusRegsWrite(int iRegAddr, QVector<quint16> data);
+    void sigModbusRegsReadWrite(int iReadAddr, quint16 iReadCount, int iWriteAddr, QVector<quint16> data);
     void sigModbusCoilWrite(int iCoilAddr, QVector<quint16> data);
     void sigModbusCoilRead(int iCoilAddr, quint16 iCoilCount);
 
@@ -117,24 +118,39 @@ private:
     QModbusDataUnit writeRequest() const;
     void fillPortsInfo();
     void loadListCSV(QString name);
+    void showReply(const ModbusEvent &ev);
+    void runScript(bool bDryRun);
 
 private slots:
     void on_connectButton_clicked();
     void onStateChanged(int state);
     void on_connectType_currentIndexChanged(int);
 
-    void readReady();
+    void slotModbusEvents();
+    void slotSnifferFrames();
+    void slotScriptRow(int row);
+    void slotScriptLoopStarted(int iLoop);
+    void slotScriptLoopFinished(int iLoopsLeft);
+    void slotScriptFinished();
 
     void on_btnDryRun_clicked();
     void on_cbCmdFile_currentTextChanged(const QString &arg1);
     void on_btnRun_clicked();
     void on_btnSend_clicked();
+    void on_btnStatsReset_clicked();
 
 private:
     Ui::MainWindow *ui;
     QModbusReply *lastRequest;
-    QModbusClient *modbusDevice;
     SettingsDialog *m_settingsDialog;
+    ModbusWorker *m_pWorker;
+    QThread m_threadModbus;
+    int m_iModbusState = QModbusDevice::UnconnectedState;
+    bool m_bScriptRunning = false;
+    QTimer m_timerStats;
+    ConsoleModel *m_pConsole;
+    bool m_bConsoleFollow = true;   //keep the newest line in view
+    BusSniffer *m_pSniffer = nullptr;
     //WriteRegisterModel *writeModel;
 };
 
@@ -14,31 +14,10 @@ void MainWindow::loadListCSV(QString sFilename)
 {
     //Open csv file from resources
     //QFile csvfile(":/ModbusTC100.csv");
-    QFile csvfile(sFilename);
-    qDebug() << "Loading" << sFilename;
-    if (!csvfile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qDebug() << "can't open CSV data file";
-        return;
-        }
-    //Stream file to listCSV
-    QTextStream csvStream(&csvfile);
     QList<QStringList> listCSV;
     QStringList listHeaderCSV;
-    int  lineNo = 0;
-    while(!csvStream.atEnd()) {
-    QString line = csvStream.readLine().simplified();
-    qDebug() << lineNo << line;
-    if (!line.isEmpty() && !line.startsWith(";") ) {
-            QStringList rowList = line.split(',');
-            if ( lineNo > 0 )
-                listCSV.append(rowList);
-            else
-                listHeaderCSV = rowList;
-            }
-        ++lineNo;
-        }
-    //csvStream.seek(0);
-    csvfile.close();
+    if (!ModbusScript::loadCSV(sFilename, listCSV, listHeaderCSV))
+        return;
 
     //qDebug() << "header" << listHeaderCSV;
     //qDebug() << "csv" << listCSV;
@@ -64,11 +43,20 @@ void MainWindow::loadListCSV(QString sFilename)
     //TableModel *csvmodel = new TableModel(listCSV, listHeaderCSV, ptvModbus);
     pModelCSV = new TableModel(listCSV, listHeaderCSV, ptvModbus);
 
+    //Compile rows once, the executor never re-parses the table.
+    //Edits apply to the next run, which optimizes a fresh copy.
+    m_program = ModbusScript::compile(listCSV);
+    QObject::connect(pModelCSV, &TableModel::dataChanged, [=](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+        QList<QStringList> listCmds = pModelCSV->getStringLists();
+        for (int r = topLeft.row(); r <= bottomRight.row(); r++)
+            m_program[r] = ModbusScript::compileRow(listCmds[r], r);
+        });
+
     ptvModbus->setModel(pModelCSV);
     //Show UI
     ptvModbus->selectRow(0);
     ptvModbus->show();
-    ui->groupBoxModbus->setTitle(csvfile.fileName());
+    ui->groupBoxModbus->setTitle(sFilename);
 
     //ReConnect doubleclick to lamda function
     QObject::disconnect(ptvModbus, &QTableView::doubleClicked, nullptr, nullptr);
@@ -100,14 +88,25 @@ void MainWindow::loadListCSV(QString sFilename)
                 _DataUnit.setValue(1, iValue&0x0FFFF);
                 }*/
 
+            //WRr holds both Rr and Wr, Poll sends one plain read of its register
             int iFC = 0;
-            if (sRW.contains("Rc",Qt::CaseInsensitive)) iFC = 0x01;
-            if (sRW.contains("Wc",Qt::CaseInsensitive)) iFC = 0x05;
-            if (sRW.contains("Rr",Qt::CaseInsensitive)) iFC = 0x03;
-            if (sRW.contains("Wr",Qt::CaseInsensitive) && iCount==1) iFC = 0x06;
-            if (sRW.contains("Wr",Qt::CaseInsensitive) && iCount>1) iFC = 0x10;
+            if (sRW.contains("Poll",Qt::CaseInsensitive)) {
+                iFC = 0x03;
+                iCount = 1;
+                }
+            else if (sRW.contains("WRr",Qt::CaseInsensitive)) {
+                iFC = 0x17;
+                }
+            else {
+                if (sRW.contains("Rc",Qt::CaseInsensitive)) iFC = 0x01;
+                if (sRW.contains("Wc",Qt::CaseInsensitive)) iFC = 0x05;
+                if (sRW.contains("Rr",Qt::CaseInsensitive)) iFC = 0x03;
+                if (sRW.contains("Wr",Qt::CaseInsensitive) && iCount==1) iFC = 0x06;
+                if (sRW.contains("Wr",Qt::CaseInsensitive) && iCount>1) iFC = 0x10;
+                }
             //target fcode regAddr value
-            char buf[64];
+            char buf[64] = "";
+            QString sLine;
             int iValue;
             switch (iFC) {
                 default:
@@ -125,6 +124,18 @@ void MainWindow::loadListCSV(QString sFilename)
                     iValue  = selected[enumModbusCSV::eValue].data().toString().toInt(&ok,16);
                     sprintf(buf, "%02X %02X %04X %04X %04X", iServerAddr, iFC, iRegAddr, iCount, iValue);
                     break;
+                case 0x17: { //read/write regs: read reg, read count, write reg, write count, data...
+                    //the compiled row, so the Value column is parsed exactly as the script does
+                    const ModbusOp op = m_program.value(current.row());
+                    if (op.fc != 0x17)
+                        break;
+                    sLine = QString::asprintf("%02X %02X %04X %d %04X %d", iServerAddr, iFC,
+                                              op.unitRead.startAddress(), op.unitRead.valueCount(),
+                                              op.unit.startAddress(), op.unit.valueCount());
+                    for (uint i=0;i<op.unit.valueCount();i++)
+                        sLine += QString::asprintf(" %04X", op.unit.value(static_cast<int>(i)));
+                    break;
+                    }
                 case 0x10: //write multiple regs
                     //addr, fc, reg, count, bytes, data...
                     //sprintf(buf, "%02X %02X %04X %04X %02X %04X%04X", iServerAddr, iFC, iRegAddr, iCount, iCount*2, _DataUnit.value(0), _DataUnit.value(1));
@@ -143,8 +154,10 @@ assert(iCount==slData.size());
                     sprintf(buf, "%02X %02X %04X %04X %02X %s", iServerAddr, iFC, iRegAddr, iCount, iCount*2, sData.toStdString().c_str());
                     break;
                 }
-            ui->lineEditModbusData->setText(QString(buf));
-            ui->btnSend->setEnabled(true);
+            if (sLine.isEmpty())
+                sLine = QString(buf);
+            ui->lineEditModbusData->setText(sLine);
+            ui->btnSend->setEnabled(!sLine.isEmpty());
             }
         qDebug() << "current item = " << current.data();
 
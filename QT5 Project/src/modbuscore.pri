@@ -0,0 +1,41 @@
+# Script compiler/executor shared by the GUI and the headless targets
+INCLUDEPATH += $$PWD
+QT += network
+
+SOURCES += $$PWD/modbusscript.cpp \
+        $$PWD/modbussettings.cpp \
+        $$PWD/scriptexecutor.cpp \
+        $$PWD/modbusworker.cpp \
+        $$PWD/pollscheduler.cpp \
+        $$PWD/modbusstats.cpp \
+        $$PWD/datalogger.cpp \
+        $$PWD/processimage.cpp \
+        $$PWD/crc16.cpp \
+        $$PWD/modbusgateway.cpp \
+        $$PWD/requestqueue.cpp
+
+HEADERS += $$PWD/modbusscript.h \
+        $$PWD/modbussettings.h \
+        $$PWD/scriptexecutor.h \
+        $$PWD/modbusworker.h \
+        $$PWD/spscring.h \
+        $$PWD/pollscheduler.h \
+        $$PWD/modbusstats.h \
+        $$PWD/datalogger.h \
+        $$PWD/processimage.h \
+        $$PWD/crc16.h \
+        $$PWD/modbusgateway.h \
+        $$PWD/requestqueue.h
+
+# Direct termios/epoll RTU transport and bus sniffer, the transport needs
+# the QtSerialBus private headers
+linux {
+    QT += serialbus-private
+    DEFINES += MODBUS_RTU_DIRECT
+    SOURCES += $$PWD/rtudirectmaster.cpp \
+        $$PWD/serialtty.cpp \
+        $$PWD/bussniffer.cpp
+    HEADERS += $$PWD/rtudirectmaster.h \
+        $$PWD/serialtty.h \
+        $$PWD/bussniffer.h
+    }
@@ -0,0 +1,344 @@
+#include "modbusgateway.h"
+#include "modbusstats.h"
+#include "processimage.h"
+
+#include <QModbusClient>
+#include <QModbusReply>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtEndian>
+
+static const int kMbapSize = 7;         //transaction, protocol, length, unit
+static const int kMaxPdu = 253;
+
+static quint16 be16(const QByteArray &data, int iPos)
+{
+    return qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(data.constData() + iPos));
+}
+
+static QModbusDataUnit::RegisterType readType(int fc)
+{
+    switch (fc) {
+        case QModbusPdu::ReadCoils:              return QModbusDataUnit::Coils;
+        case QModbusPdu::ReadDiscreteInputs:     return QModbusDataUnit::DiscreteInputs;
+        case QModbusPdu::ReadHoldingRegisters:   return QModbusDataUnit::HoldingRegisters;
+        case QModbusPdu::ReadInputRegisters:     return QModbusDataUnit::InputRegisters;
+        default:                                 return QModbusDataUnit::Invalid;
+        }
+}
+
+static bool isBitType(QModbusDataUnit::RegisterType type)
+{
+    return type == QModbusDataUnit::Coils || type == QModbusDataUnit::DiscreteInputs;
+}
+
+ModbusGateway::ModbusGateway(QObject *parent)
+    : QObject(parent)
+    , m_pServer(new QTcpServer(this))
+{
+    connect(m_pServer, &QTcpServer::newConnection, this, &ModbusGateway::onNewConnection);
+}
+
+ModbusGateway::~ModbusGateway()
+{
+    close();
+}
+
+void ModbusGateway::setDevice(QModbusClient *device)
+{
+    m_pDevice = device;
+    if (m_pDevice)
+        connect(m_pDevice, &QModbusDevice::stateChanged, this, &ModbusGateway::dispatch);
+}
+
+void ModbusGateway::setCache(ProcessImage *pImage, int iMaxAgeMs)
+{
+    m_pImage = pImage;
+    m_iCacheAge = iMaxAgeMs;
+}
+
+void ModbusGateway::setStats(ModbusStats *pStats)
+{
+    m_pStats = pStats;
+}
+
+bool ModbusGateway::listen(quint16 port, QString &sError)
+{
+    if (m_pServer->listen(QHostAddress::Any, port))
+        return true;
+    sError = m_pServer->errorString();
+    return false;
+}
+
+void ModbusGateway::close()
+{
+    m_pServer->close();
+    for (QTcpSocket *socket : m_listClients) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+        }
+    m_listClients.clear();
+    m_hashClients.clear();
+    m_iNext = 0;
+}
+
+void ModbusGateway::onNewConnection()
+{
+    while (QTcpSocket *socket = m_pServer->nextPendingConnection()) {
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        m_listClients.append(socket);
+        m_hashClients.insert(socket, Client());
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() { onDisconnected(socket); });
+        emit message(tr("Gateway: %1:%2 connected, %3 clients")
+                     .arg(socket->peerAddress().toString()).arg(socket->peerPort()).arg(m_listClients.size()));
+        }
+}
+
+//an in flight request of the client finishes on the line, its answer is dropped
+void ModbusGateway::onDisconnected(QTcpSocket *socket)
+{
+    const int i = m_listClients.indexOf(socket);
+    if (i < 0)
+        return;
+    m_listClients.removeAt(i);
+    if (i < m_iNext)
+        m_iNext--;
+    m_hashClients.remove(socket);
+    socket->deleteLater();
+    emit message(tr("Gateway: client gone, %1 clients").arg(m_listClients.size()));
+}
+
+void ModbusGateway::onReadyRead(QTcpSocket *socket)
+{
+    auto it = m_hashClients.find(socket);
+    if (it == m_hashClients.end())
+        return;
+    Client &client = it.value();
+    client.buffer.append(socket->readAll());
+
+    while (client.buffer.size() >= kMbapSize + 1) {
+        const quint16 uProtocol = be16(client.buffer, 2);
+        const int iLength = be16(client.buffer, 4);     //unit + PDU
+        if (uProtocol != 0 || iLength < 2 || iLength > kMaxPdu + 1) {
+            emit message(tr("Gateway: %1 sent no Modbus TCP, dropped").arg(socket->peerAddress().toString()));
+            socket->abort();
+            return;
+            }
+        if (client.buffer.size() < 6 + iLength)
+            break;
+
+        Request req;
+        req.uTransaction = be16(client.buffer, 0);
+        req.unit = static_cast<quint8>(client.buffer.at(6));
+        req.pdu = QModbusRequest(static_cast<QModbusPdu::FunctionCode>(static_cast<quint8>(client.buffer.at(7))),
+                                 client.buffer.mid(8, iLength - 2));
+        req.llQueuedNs = m_pStats ? m_pStats->now() : 0;
+        client.buffer.remove(0, 6 + iLength);
+
+        //behind a write of its own still waiting, a cached read would be stale
+        const bool bIdle = client.queue.isEmpty() && (m_pReplySocket.data() != socket);
+        if (bIdle && serveCached(socket, req))
+            continue;
+        if (client.queue.size() >= m_iQueueLimit) {
+            respond(socket, req, QModbusExceptionResponse(req.pdu.functionCode(), QModbusPdu::ServerDeviceBusy));
+            continue;
+            }
+        client.queue.enqueue(req);
+        }
+    dispatch();
+}
+
+/*** the line: one request at a time, the next client in turn ***/
+
+void ModbusGateway::dispatch()
+{
+    while (!m_pReply && !m_listClients.isEmpty()) {
+        Client *pClient = nullptr;
+        QTcpSocket *socket = nullptr;
+        const int n = m_listClients.size();
+        for (int i = 0; i < n && !pClient; i++) {
+            const int iClient = (m_iNext + i) % n;
+            Client &client = m_hashClients[m_listClients[iClient]];
+            if (!client.queue.isEmpty()) {
+                pClient = &client;
+                socket = m_listClients[iClient];
+                m_iNext = (iClient + 1) % n;
+                }
+            }
+        if (!pClient)
+            return;
+
+        const Request req = pClient->queue.dequeue();
+        const int fc = req.pdu.functionCode();
+        if (!m_pDevice || m_pDevice->state() != QModbusDevice::ConnectedState) {
+            respond(socket, req, QModbusExceptionResponse(req.pdu.functionCode(), QModbusPdu::GatewayPathUnavailable));
+            continue;
+            }
+        if (m_pStats)
+            m_pStats->applyTimeout(m_pDevice, fc, req.unit);
+        QModbusReply *reply = m_pDevice->sendRawRequest(req.pdu, req.unit);
+        if (!reply) {
+            if (m_pStats)
+                m_pStats->sendFailed();
+            respond(socket, req, QModbusExceptionResponse(req.pdu.functionCode(), QModbusPdu::GatewayPathUnavailable));
+            continue;
+            }
+        if (m_pStats)
+            m_pStats->requestSent(reply->isFinished() ? nullptr : reply, fc, req.unit, req.llQueuedNs);
+        if (reply->isFinished()) {      //broadcast
+            reply->deleteLater();
+            continue;
+            }
+        m_pReply = reply;
+        m_pReplySocket = socket;
+        m_inFlight = req;
+        connect(reply, &QModbusReply::finished, this, &ModbusGateway::onReplyFinished);
+        }
+}
+
+void ModbusGateway::onReplyFinished()
+{
+    QModbusReply *reply = m_pReply;
+    m_pReply = nullptr;
+    if (!reply)
+        return;
+    if (m_pStats)
+        m_pStats->replyFinished(reply);
+
+    const QModbusResponse response = reply->rawResult();
+    if (reply->error() == QModbusDevice::NoError && response.isValid())
+        updateImage(m_inFlight, response);
+    if (m_pReplySocket && m_inFlight.unit != 0) {
+        if ((reply->error() == QModbusDevice::NoError || reply->error() == QModbusDevice::ProtocolError) && response.isValid())
+            respond(m_pReplySocket, m_inFlight, response);
+        else if (reply->error() == QModbusDevice::TimeoutError)
+            respond(m_pReplySocket, m_inFlight, QModbusExceptionResponse(m_inFlight.pdu.functionCode(),
+                                                                         QModbusPdu::GatewayTargetDeviceFailedToRespond));
+        else
+            respond(m_pReplySocket, m_inFlight, QModbusExceptionResponse(m_inFlight.pdu.functionCode(),
+                                                                         QModbusPdu::GatewayPathUnavailable));
+        }
+    m_pReplySocket.clear();
+    reply->deleteLater();
+    dispatch();
+}
+
+/*** shadow registers ***/
+
+bool ModbusGateway::serveCached(QTcpSocket *socket, const Request &req)
+{
+    if (!m_pImage || m_iCacheAge <= 0 || req.unit == 0)
+        return false;
+    const QModbusDataUnit::RegisterType type = readType(req.pdu.functionCode());
+    const QByteArray data = req.pdu.data();
+    if (type == QModbusDataUnit::Invalid || data.size() != 4)
+        return false;
+    const int iCount = be16(data, 2);
+    if (iCount < 1 || iCount > (isBitType(type) ? 2000 : 125))
+        return false;   //the slave answers the exception
+
+    QModbusDataUnit unit(type, be16(data, 0), static_cast<quint16>(iCount));
+    if (!m_pImage->read(req.unit, unit, m_iCacheAge)) {
+        if (m_pStats)
+            m_pStats->cacheMiss();
+        return false;
+        }
+    if (m_pStats)
+        m_pStats->cacheHit();
+
+    QByteArray payload;
+    if (isBitType(type)) {
+        payload.fill(0, 1 + (iCount + 7)/8);
+        for (int i = 0; i < iCount; i++)
+            if (unit.value(i))
+                payload[1 + i/8] = static_cast<char>(payload.at(1 + i/8) | (1 << (i % 8)));
+        }
+    else {
+        payload.resize(1 + 2*iCount);
+        for (int i = 0; i < iCount; i++)
+            qToBigEndian<quint16>(unit.value(i), reinterpret_cast<uchar *>(payload.data() + 1 + 2*i));
+        }
+    payload[0] = static_cast<char>(payload.size() - 1);
+    respond(socket, req, QModbusResponse(req.pdu.functionCode(), payload));
+    return true;
+}
+
+//reads as answered, writes as sent: the slave acknowledged them
+void ModbusGateway::updateImage(const Request &req, const QModbusResponse &response)
+{
+    if (!m_pImage || req.unit == 0)
+        return;
+    const QByteArray data = req.pdu.data();
+    const QByteArray reply = response.data();
+    if (data.size() < 4)
+        return;
+    const quint16 address = be16(data, 0);
+    const int fc = req.pdu.functionCode();
+
+    const QModbusDataUnit::RegisterType type = readType(fc);
+    if (type != QModbusDataUnit::Invalid) {
+        const int iCount = be16(data, 2);
+        QVector<quint16> values(iCount);
+        if (isBitType(type)) {
+            if (reply.size() < 1 + (iCount + 7)/8)
+                return;
+            for (int i = 0; i < iCount; i++)
+                values[i] = (static_cast<quint8>(reply.at(1 + i/8)) >> (i % 8)) & 1;
+            }
+        else {
+            if (reply.size() < 1 + 2*iCount)
+                return;
+            for (int i = 0; i < iCount; i++)
+                values[i] = be16(reply, 1 + 2*i);
+            }
+        m_pImage->update(req.unit, QModbusDataUnit(type, address, values));
+        return;
+        }
+
+    switch (fc) {
+        case QModbusPdu::WriteSingleCoil:
+            m_pImage->update(req.unit, QModbusDataUnit(QModbusDataUnit::Coils, address,
+                                                       QVector<quint16>() << (be16(data, 2) == 0xFF00 ? 1 : 0)));
+            break;
+        case QModbusPdu::WriteSingleRegister:
+            m_pImage->update(req.unit, QModbusDataUnit(QModbusDataUnit::HoldingRegisters, address,
+                                                       QVector<quint16>() << be16(data, 2)));
+            break;
+        case QModbusPdu::WriteMultipleCoils: {
+            const int iCount = be16(data, 2);
+            if (data.size() < 5 + (iCount + 7)/8)
+                return;
+            QVector<quint16> values(iCount);
+            for (int i = 0; i < iCount; i++)
+                values[i] = (static_cast<quint8>(data.at(5 + i/8)) >> (i % 8)) & 1;
+            m_pImage->update(req.unit, QModbusDataUnit(QModbusDataUnit::Coils, address, values));
+            break;
+            }
+        case QModbusPdu::WriteMultipleRegisters: {
+            const int iCount = be16(data, 2);
+            if (data.size() < 5 + 2*iCount)
+                return;
+            QVector<quint16> values(iCount);
+            for (int i = 0; i < iCount; i++)
+                values[i] = be16(data, 5 + 2*i);
+            m_pImage->update(req.unit, QModbusDataUnit(QModbusDataUnit::HoldingRegisters, address, values));
+            break;
+            }
+        default:
+            break;
+        }
+}
+
+void ModbusGateway::respond(QTcpSocket *socket, const Request &req, const QModbusPdu &pdu)
+{
+    const QByteArray data = pdu.data();
+    QByteArray adu(kMbapSize + 1, 0);
+    qToBigEndian<quint16>(req.uTransaction, reinterpret_cast<uchar *>(adu.data()));
+    qToBigEndian<quint16>(static_cast<quint16>(2 + data.size()), reinterpret_cast<uchar *>(adu.data() + 4));
+    adu[6] = static_cast<char>(req.unit);
+    adu[7] = static_cast<char>(pdu.isException() ? pdu.functionCode() | QModbusPdu::ExceptionByte : pdu.functionCode());
+    adu.append(data);
+    socket->write(adu);
+}
@@ -0,0 +1,96 @@
+/****************************************************************************
+**
+** ModbusGateway
+**
+**  Modbus TCP server in front of the one RTU master: every client gets
+**  its own queue and the RTU line takes one request at a time from them
+**  round robin, so a client hammering the gateway only delays itself.
+**  A full queue answers exception 6 (busy) instead of growing. Reads of
+**  values younger than the cache age in the ProcessImage are answered
+**  at once without touching the line, unless the client still has
+**  requests of its own waiting or on the line; RTU replies and forwarded
+**  writes keep the image current. No answer in time is exception 0x0B, no
+**  line at all 0x0A. Broadcasts (unit 0) are forwarded, never answered.
+**
+****************************************************************************/
+
+#ifndef MODBUSGATEWAY_H
+#define MODBUSGATEWAY_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QModbusPdu>
+#include <QPointer>
+#include <QQueue>
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+class QTcpServer;
+class QTcpSocket;
+QT_END_NAMESPACE
+
+class ModbusStats;
+class ProcessImage;
+
+class ModbusGateway : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ModbusGateway(QObject *parent = nullptr);
+    ~ModbusGateway();
+
+    void setDevice(QModbusClient *device);
+    //iMaxAgeMs 0 = every read goes to the line
+    void setCache(ProcessImage *pImage, int iMaxAgeMs);
+    void setStats(ModbusStats *pStats);
+    //requests one client may have waiting for the line
+    void setQueueLimit(int iLimit) { m_iQueueLimit = qMax(1, iLimit); }
+
+    bool listen(quint16 port, QString &sError);
+    void close();
+    int clients() const { return m_listClients.size(); }
+
+signals:
+    void message(const QString &sText);
+
+private:
+    struct Request {
+        quint16 uTransaction = 0;
+        quint8  unit = 0;
+        QModbusRequest pdu;
+        qint64  llQueuedNs = 0;
+    };
+    struct Client {
+        QByteArray buffer;
+        QQueue<Request> queue;
+    };
+
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    void onDisconnected(QTcpSocket *socket);
+    void dispatch();
+    void onReplyFinished();
+    bool serveCached(QTcpSocket *socket, const Request &req);
+    void updateImage(const Request &req, const QModbusResponse &response);
+    void respond(QTcpSocket *socket, const Request &req, const QModbusPdu &pdu);
+
+    QTcpServer *m_pServer;
+    QModbusClient *m_pDevice = nullptr;
+    ProcessImage *m_pImage = nullptr;
+    int m_iCacheAge = 0;
+    ModbusStats *m_pStats = nullptr;
+    int m_iQueueLimit = 16;
+
+    QList<QTcpSocket *> m_listClients;      //round robin order
+    QHash<QTcpSocket *, Client> m_hashClients;
+    int m_iNext = 0;
+
+    QModbusReply *m_pReply = nullptr;       //the one request on the line
+    QPointer<QTcpSocket> m_pReplySocket;
+    Request m_inFlight;
+};
+
+#endif // MODBUSGATEWAY_H
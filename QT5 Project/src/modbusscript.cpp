@@ -0,0 +1,368 @@
+/*
+**  CSV script compiler
+**
+**  RW column     fcode   table
+**    Rc          0x02    DiscreteInputs
+**    Rr          0x03    HoldingRegisters
+**    Wc          0x05    Coils
+**    Wr          0x06/0x10 HoldingRegisters, Count regs up to 123, Value
+**                        "word word ..." (hex), built once at load time
+**    Wr+         as Wr, merged with the next Wr row when that one starts
+**                right after it (same slave), see coalesceWrites()
+**    WRr         0x17    HoldingRegisters, write like Wr (up to 121 regs)
+**                        then read in the same transaction, Value
+**                        "value @reg:count" (hex reg, count default 1),
+**                        no @ = read back the write
+**    Poll        0x03    HoldingRegisters, Value "mask value" (hex),
+**                        re-read until it matches, Wait(ms) = timeout
+**
+**  A trailing ! (Wr!, Wr+!) sends the row in the emergency class of the
+**  RequestQueue, ahead of everything that is waiting; a trailing - (Rr-)
+**  in the background class, behind the polling.
+**
+**  Optional columns after Act/Run:
+**    Slave       server address of the row, empty or 0 = session address
+**    Period(ms)  > 0 makes the row cyclic, run by the PollScheduler
+**    MaxAge(ms)  Rr/Rc served from the process image when the cached
+**                values are younger, empty = session default, 0 = never
+**
+*/
+
+#include "modbusscript.h"
+#include "requestqueue.h"
+
+#include <QFile>
+#include <QModbusClient>
+#include <QRegExp>
+#include <QTextStream>
+#include <QDebug>
+#include <ctype.h>
+
+static const int kMaxWriteRegs = 123;
+static const int kMaxReadWriteRegs = 121;   //FC23 write quantity, 0x79
+
+//Wr payload of Count words: "0000 1388 ..." one hex word each, the same
+//list the double-click Send line takes. A single value on a Count 2 row
+//is still split into high and low word, missing words are 0.
+static QVector<quint16> regWords(int iCount, const QString &sValue, int iMaxRegs = kMaxWriteRegs)
+{
+    bool ok;
+    QStringList listWords = sValue.split(QRegExp("[ ;]"), QString::SkipEmptyParts);
+    QVector<quint16> data(qBound(1, iCount, iMaxRegs));
+    if ((listWords.size() == 1) && (data.size() == 2)) {
+        uint uValue = listWords[0].toUInt(&ok, 16);
+        data[0] = static_cast<quint16>(uValue>>16);
+        data[1] = uValue&0x0FFFF;
+        return data;
+        }
+    if (listWords.size() > data.size())
+        qDebug() << "Value has" << listWords.size() << "words, Count" << data.size();
+    for (int i = 0; (i < listWords.size()) && (i < data.size()); i++)
+        data[i] = static_cast<quint16>(listWords[i].toUInt(&ok, 16));
+    return data;
+}
+
+//">0x0064" for one word, ">0000 1388" for more
+static QString formatWords(const QVector<quint16> &data)
+{
+    if (data.size() == 1)
+        return QString::asprintf(">0x%04X", data[0]);
+    QString sWords = ">";
+    for (quint16 word : data)
+        sWords += QString::asprintf("%04X ", word);
+    sWords.chop(1);
+    return sWords;
+}
+
+bool ModbusScript::loadCSV(const QString &sFilename, QList<QStringList> &listCSV, QStringList &listHeader)
+{
+    QFile csvfile(sFilename);
+    qDebug() << "Loading" << sFilename;
+    if (!csvfile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qDebug() << "can't open CSV data file";
+        return false;
+        }
+    //Stream file to listCSV
+    QTextStream csvStream(&csvfile);
+    int  lineNo = 0;
+    while(!csvStream.atEnd()) {
+        QString line = csvStream.readLine().simplified();
+        qDebug() << lineNo << line;
+        if (!line.isEmpty() && !line.startsWith(";") ) {
+            QStringList rowList = line.split(',');
+            if ( lineNo > 0 )
+                listCSV.append(rowList);
+            else
+                listHeader = rowList;
+            }
+        ++lineNo;
+        }
+    csvfile.close();
+    return true;
+}
+
+ModbusOp ModbusScript::compileRow(const QStringList &row, int iRow)
+{
+    ModbusOp op;
+    op.row = iRow;
+    if (row.size() <= enumModbusCSV::eActRun)
+        return op; //malformed row, never sent
+
+    bool ok;
+    int iRegAddr= row[enumModbusCSV::eReg].toInt(&ok, 16);
+    int  iCount = row[enumModbusCSV::eCount].toInt(&ok, 10);
+    QString sRW = row[enumModbusCSV::eRW].trimmed();
+    int iValue  = row[enumModbusCSV::eValue].toInt(&ok, 16);
+    op.wait     = row[enumModbusCSV::eWait].toInt(&ok, 10);
+    op.loop     = row[enumModbusCSV::eLoop].toInt(&ok, 10);
+    op.bRun     = row[enumModbusCSV::eActRun].toInt(&ok, 10) != 0;
+    if (op.wait < 0) op.wait = 0;
+    if (row.size() > enumModbusCSV::eSlave)
+        op.slave = static_cast<quint8>(qBound(0, row[enumModbusCSV::eSlave].toInt(&ok, 10), 247));
+    if (row.size() > enumModbusCSV::ePeriod)
+        op.period = qMax(0, row[enumModbusCSV::ePeriod].toInt(&ok, 10));
+    if ((row.size() > enumModbusCSV::eMaxAge) && !row[enumModbusCSV::eMaxAge].trimmed().isEmpty())
+        op.maxAge = qMax(0, row[enumModbusCSV::eMaxAge].toInt(&ok, 10));
+    if (sRW.contains('!'))
+        op.priority = RequestQueue::eEmergency;
+    else if (sRW.endsWith('-'))
+        op.priority = RequestQueue::eBackground;
+
+    char buf[128];
+    if (sRW.contains("Poll", Qt::CaseInsensitive)) { //Read until condition
+        QStringList listValue = row[enumModbusCSV::eValue].simplified().split(' ', QString::SkipEmptyParts);
+        op.fc = 0x03;
+        op.bPoll = true;
+        if (listValue.size() > 1) {
+            op.pollMask = static_cast<quint16>(listValue[0].toUInt(&ok, 16));
+            op.pollValue = static_cast<quint16>(listValue[1].toUInt(&ok, 16));
+            }
+        else if (listValue.size() == 1) {
+            op.pollValue = static_cast<quint16>(listValue[0].toUInt(&ok, 16));
+            }
+        op.unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, 1);
+        snprintf(buf, sizeof(buf), "  %s @0x%04X &0x%04X ==0x%04X %dms ", sRW.toStdString().c_str(), iRegAddr,
+                 op.pollMask, op.pollValue, op.wait);
+        op.sStep = QString(buf);
+        return op;
+        }
+    else if (sRW.contains("WRr", Qt::CaseInsensitive)) { //Write then read regs, one round trip
+        QString sValue = row[enumModbusCSV::eValue];
+        int iAt = sValue.indexOf('@');
+        QVector<quint16> data = regWords(iCount, sValue.left(iAt), kMaxReadWriteRegs);
+        int iReadAddr = iRegAddr;
+        int iReadCount = data.size();
+        if (iAt >= 0) {
+            QStringList listRead = sValue.mid(iAt + 1).simplified().split(':');
+            iReadAddr = listRead[0].toInt(&ok, 16);
+            iReadCount = (listRead.size() > 1) ? qBound(1, listRead[1].toInt(&ok, 10), 125) : 1;
+            }
+        op.fc = 0x17;
+        op.unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, data);
+        op.unitRead = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iReadAddr, static_cast<quint16>(iReadCount));
+        snprintf(buf, sizeof(buf), "  %s %d @0x%X ", sRW.toStdString().c_str(), data.size(), iRegAddr);
+        op.sStep = QString(buf) + formatWords(data) + QString::asprintf(" <0x%04X:%d ", iReadAddr, iReadCount);
+        return op;
+        }
+    else if (sRW.contains("Rc", Qt::CaseInsensitive)) { //Read coil
+        op.fc = 0x02;
+        op.unit = QModbusDataUnit(QModbusDataUnit::DiscreteInputs, iRegAddr, static_cast<quint16>(iCount));
+        }
+    else if (sRW.contains("Rr", Qt::CaseInsensitive)) { //Read regs
+        op.fc = 0x03;
+        op.unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, static_cast<quint16>(iCount));
+        }
+    else if (sRW.contains("Wc", Qt::CaseInsensitive)) { //Write single coil
+        QVector<quint16> data(1);
+        data[0] = static_cast<quint16>(iValue);
+        op.fc = 0x05;
+        op.unit = QModbusDataUnit(QModbusDataUnit::Coils, iRegAddr, data);
+        }
+    else if (sRW.contains("Wr", Qt::CaseInsensitive)) { //Write regs
+        QVector<quint16> data = regWords(iCount, row[enumModbusCSV::eValue]);
+        op.fc = (data.size() == 1) ? 0x06 : 0x10;
+        op.bCombine = sRW.contains('+');
+        op.unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, data);
+        snprintf(buf, sizeof(buf), "  %s %d @0x%X ", sRW.toStdString().c_str(), data.size(), iRegAddr);
+        op.sStep = QString(buf) + formatWords(data) + " ";
+        return op;
+        }
+
+    if (op.fc == 0x05)
+        snprintf(buf, sizeof(buf), "  %s %d @0x%X >0x%04X ", sRW.toStdString().c_str(), iCount, iRegAddr, iValue);
+    else
+        snprintf(buf, sizeof(buf), "  %s %d @0x%04X ", sRW.toStdString().c_str(), iCount, iRegAddr);
+    op.sStep = QString(buf);
+    return op;
+}
+
+ModbusProgram ModbusScript::compile(const QList<QStringList> &listCSV)
+{
+    ModbusProgram program;
+    program.reserve(listCSV.size());
+    for (int r = 0; r < listCSV.size(); r++)
+        program.append(compileRow(listCSV[r], r));
+    return program;
+}
+
+bool ModbusScript::isRead(const ModbusOp &op)
+{
+    return (op.fc >= 0x01) && (op.fc <= 0x04);
+}
+
+//FC23 carries both halves, the reply result is the read half
+QModbusReply *ModbusScript::send(QModbusClient *device, const ModbusOp &op, int iServerAddr)
+{
+    if (op.fc == 0x17)
+        return device->sendReadWriteRequest(op.unitRead, op.unit, iServerAddr);
+    if (isRead(op))
+        return device->sendReadRequest(op.unit, iServerAddr);
+    return device->sendWriteRequest(op.unit, iServerAddr);
+}
+
+//true when any enabled row has a Period, the script is then a poll schedule
+bool ModbusScript::isScheduled(const ModbusProgram &program)
+{
+    for (const ModbusOp &op : program) {
+        if (op.bRun && op.fc && (op.period > 0))
+            return true;
+        }
+    return false;
+}
+
+//Merge runs of Rr rows on the same slave into one FC03 read when the
+//registers between them are at most iGap and the span fits one request.
+//Disabled rows are dropped, iGap < 0 leaves the program untouched.
+ModbusProgram ModbusScript::coalesceReads(const ModbusProgram &program, int iGap)
+{
+    if (iGap < 0)
+        return program;
+
+    static const int kMaxReadRegs = 125;
+    ModbusProgram optimized;
+    optimized.reserve(program.size());
+    for (const ModbusOp &op : program) {
+        if (!op.bRun || (op.loop <= 0))
+            continue;
+
+        bool bMerge = false;
+        int iLo = 0, iHi = 0;
+        if (!optimized.isEmpty() && (op.fc == 0x03) && !op.bPoll && (op.loop == 1)) {
+            const ModbusOp &last = optimized.last();
+            if ((last.fc == 0x03) && !last.bPoll && (last.loop == 1) && (last.slave == op.slave)
+                    && (last.period == op.period) && (last.maxAge == op.maxAge) && (last.priority == op.priority)) {
+                int iLastLo = last.unit.startAddress();
+                int iLastHi = iLastLo + static_cast<int>(last.unit.valueCount());
+                int iOpLo = op.unit.startAddress();
+                int iOpHi = iOpLo + static_cast<int>(op.unit.valueCount());
+                int iHole = qMax(iOpLo - iLastHi, iLastLo - iOpHi);
+                iLo = qMin(iLastLo, iOpLo);
+                iHi = qMax(iLastHi, iOpHi);
+                bMerge = (iHole <= iGap) && ((iHi - iLo) <= kMaxReadRegs);
+                }
+            }
+        if (!bMerge) {
+            optimized.append(op);
+            continue;
+            }
+
+        ModbusOp &last = optimized.last();
+        if (last.slices.isEmpty()) {
+            ModbusSlice first;
+            first.row = last.row;
+            first.count = static_cast<quint16>(last.unit.valueCount());
+            first.sStep = last.sStep;
+            last.slices.append(first);
+            }
+        //re-base earlier rows when the new one sits below them
+        quint16 shift = static_cast<quint16>(last.unit.startAddress() - iLo);
+        for (ModbusSlice &slice : last.slices)
+            slice.offset += shift;
+
+        ModbusSlice slice;
+        slice.row = op.row;
+        slice.offset = static_cast<quint16>(op.unit.startAddress() - iLo);
+        slice.count = static_cast<quint16>(op.unit.valueCount());
+        slice.sStep = op.sStep;
+        last.slices.append(slice);
+
+        last.unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iLo, static_cast<quint16>(iHi - iLo));
+        last.wait = op.wait; //pause before whatever follows the merged rows
+        }
+    return optimized;
+}
+
+//Merge a Wr+ row with the Wr row that follows it when the second one
+//starts at the register after the first, on the same slave, into one
+//FC16 write. Chains while the last merged row is marked Wr+; the Wait of
+//the rows inside the chain is dropped. Disabled rows are dropped.
+ModbusProgram ModbusScript::coalesceWrites(const ModbusProgram &program)
+{
+    ModbusProgram optimized;
+    optimized.reserve(program.size());
+    for (const ModbusOp &op : program) {
+        if (!op.bRun || (op.loop <= 0))
+            continue;
+
+        bool bMerge = false;
+        if (!optimized.isEmpty() && ((op.fc == 0x06) || (op.fc == 0x10)) && (op.loop == 1)) {
+            const ModbusOp &last = optimized.last();
+            bMerge = last.bCombine && ((last.fc == 0x06) || (last.fc == 0x10)) && (last.loop == 1)
+                    && (last.slave == op.slave) && (last.period == op.period) && (last.priority == op.priority)
+                    && (op.unit.startAddress() == last.unit.startAddress() + static_cast<int>(last.unit.valueCount()))
+                    && (last.unit.valueCount() + op.unit.valueCount() <= kMaxWriteRegs);
+            }
+        if (!bMerge) {
+            optimized.append(op);
+            continue;
+            }
+
+        ModbusOp &last = optimized.last();
+        if (last.slices.isEmpty()) {
+            ModbusSlice first;
+            first.row = last.row;
+            first.count = static_cast<quint16>(last.unit.valueCount());
+            first.sStep = last.sStep;
+            last.slices.append(first);
+            }
+        ModbusSlice slice;
+        slice.row = op.row;
+        slice.offset = static_cast<quint16>(last.unit.valueCount());
+        slice.count = static_cast<quint16>(op.unit.valueCount());
+        slice.sStep = op.sStep;
+        last.slices.append(slice);
+
+        last.unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, last.unit.startAddress(),
+                                    last.unit.values() + op.unit.values());
+        last.fc = 0x10;
+        last.wait = op.wait;
+        last.bCombine = op.bCombine;
+        }
+    return optimized;
+}
+
+QModbusDataUnit ModbusScript::sliceUnit(const QModbusDataUnit &unit, const ModbusSlice &slice)
+{
+    return QModbusDataUnit(unit.registerType(), unit.startAddress() + slice.offset,
+                           unit.values().mid(slice.offset, slice.count));
+}
+
+//"<0x1000:|0001|0002|(....)" register dump with printable chars
+QString ModbusScript::formatUnit(const QModbusDataUnit &unit)
+{
+    int iCounts = static_cast<int>(unit.valueCount());
+    char buf[32];
+    sprintf(buf, "<0x%04X:|", unit.startAddress());
+    QString sData = QString(buf);
+    QString sString="(";
+    for (int i = 0; i < iCounts; i++) {
+        sprintf(buf, "%04X|",  unit.value(i));
+        sData += QString(buf);
+        char c1 =  (unit.value(i)&0xFF00)>>8;
+        char c2 =  (unit.value(i)&0x00FF);
+        sString += isprint(c1)?QString(QChar::fromLatin1(c1)):".";
+        sString += isprint(c2)?QString(QChar::fromLatin1(c2)):".";
+        }
+    sString += ")";
+    return sData+sString;
+}
@@ -0,0 +1,74 @@
+/****************************************************************************
+**
+** ModbusScript
+**
+**  CSV script compiler. Rows are decoded once at load time into a flat
+**  vector of ModbusOp; the executor only walks it by index, the
+**  TableModel stays a view of the file.
+**
+****************************************************************************/
+
+#ifndef MODBUSSCRIPT_H
+#define MODBUSSCRIPT_H
+
+#include <QModbusDataUnit>
+#include <QStringList>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+QT_END_NAMESPACE
+
+enum enumModbusCSV {eCategory=0, eDescription, eCount, eReg, eRW, eValue, eWait, eLoop, eActRun,
+                    eSlave, ePeriod, eMaxAge};   //optional columns
+
+//one CSV row inside a request merged by the optimizer
+struct ModbusSlice
+{
+    int     row = -1;
+    quint16 offset = 0;     //first value of the row inside the merged reply
+    quint16 count = 0;
+    QString sStep;
+};
+Q_DECLARE_TYPEINFO(ModbusSlice, Q_MOVABLE_TYPE);
+
+struct ModbusOp
+{
+    quint8  fc = 0;         //Modbus function code, 0 = nothing to send
+    quint8  slave = 0;      //0 = session server address
+    bool    bRun = false;   //Act/Run
+    int     wait = 0;       //ms, counted from send
+    int     loop = 1;
+    int     row = -1;       //source CSV row
+    QModbusDataUnit unit;   //table, start address, count and pre-built payload
+    QModbusDataUnit unitRead; //FC23 only, the read half, unit is the write half
+    QString sStep;          //console line printed for every send
+    QVector<ModbusSlice> slices; //rows merged into this op, empty for a plain row
+    bool    bPoll = false;  //re-read until (value & pollMask) == pollValue, wait is the timeout
+    quint16 pollMask = 0xFFFF;
+    quint16 pollValue = 0;
+    int     period = 0;     //ms, > 0 = cyclic row for the PollScheduler
+    bool    bCombine = false; //Wr+, may share one FC16 with the next contiguous Wr row
+    int     maxAge = -1;    //ms, read cache age for this row, -1 = session default, 0 = never cached
+    int     priority = -1;  //RequestQueue::Priority, Wr! = emergency, Rr- = background, -1 = the runner's class
+};
+Q_DECLARE_TYPEINFO(ModbusOp, Q_MOVABLE_TYPE);
+
+typedef QVector<ModbusOp> ModbusProgram;
+
+namespace ModbusScript
+{
+    bool loadCSV(const QString &sFilename, QList<QStringList> &listCSV, QStringList &listHeader);
+    ModbusOp compileRow(const QStringList &row, int iRow);
+    ModbusProgram compile(const QList<QStringList> &listCSV);
+    bool isRead(const ModbusOp &op);
+    QModbusReply *send(QModbusClient *device, const ModbusOp &op, int iServerAddr);
+    bool isScheduled(const ModbusProgram &program);
+    ModbusProgram coalesceReads(const ModbusProgram &program, int iGap);
+    ModbusProgram coalesceWrites(const ModbusProgram &program);
+    QModbusDataUnit sliceUnit(const QModbusDataUnit &unit, const ModbusSlice &slice);
+    QString formatUnit(const QModbusDataUnit &unit);
+}
+
+#endif // MODBUSSCRIPT_H
@@ -0,0 +1,46 @@
+/*
+**  Apply ModbusSettings to a QModbusClient
+**
+*/
+
+#include "modbussettings.h"
+#ifdef MODBUS_RTU_DIRECT
+#include "rtudirectmaster.h"
+#endif
+
+#include <QModbusRtuSerialMaster>
+#include <QModbusTcpClient>
+#include <QUrl>
+
+void applyModbusSettings(QModbusClient *device, const QString &sPort, const ModbusSettings &settings)
+{
+    if (!qobject_cast<QModbusTcpClient *>(device)) {
+        device->setConnectionParameter(QModbusDevice::SerialPortNameParameter, sPort);
+        device->setConnectionParameter(QModbusDevice::SerialParityParameter,   settings.parity);
+        device->setConnectionParameter(QModbusDevice::SerialBaudRateParameter, settings.baud);
+        device->setConnectionParameter(QModbusDevice::SerialDataBitsParameter, settings.dataBits);
+        device->setConnectionParameter(QModbusDevice::SerialStopBitsParameter, settings.stopBits);
+    } else {
+        const QUrl url = QUrl::fromUserInput(sPort);
+        device->setConnectionParameter(QModbusDevice::NetworkPortParameter, url.port());
+        device->setConnectionParameter(QModbusDevice::NetworkAddressParameter, url.host());
+        }
+    device->setTimeout(settings.responseTime);
+    device->setNumberOfRetries(settings.numberOfRetries);
+}
+
+QModbusClient *createModbusClient(ModbusTransport transport, ModbusStats *pStats, QObject *parent)
+{
+    if (transport == eTransportTcp)
+        return new QModbusTcpClient(parent);
+#ifdef MODBUS_RTU_DIRECT
+    if (transport == eTransportRtuDirect) {
+        auto device = new RtuDirectMaster(parent);
+        device->setStats(pStats);
+        return device;
+        }
+#else
+    Q_UNUSED(pStats);
+#endif
+    return new QModbusRtuSerialMaster(parent);
+}
@@ -0,0 +1,52 @@
+/****************************************************************************
+**
+** ModbusSettings
+**
+**  Connection parameters shared by the GUI SettingsDialog and the
+**  headless runner, plus the helper that applies them to a client.
+**
+****************************************************************************/
+
+#ifndef MODBUSSETTINGS_H
+#define MODBUSSETTINGS_H
+
+#include <QSerialPort>
+#include <QString>
+
+#define default_modebus_ip "192.168.0.12:502"
+#define default_serialport "/dev/ttyS0"
+#define default_USBport "/dev/ttyUSB0"
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QObject;
+QT_END_NAMESPACE
+
+class ModbusStats;
+
+enum ModbusTransport {
+    eTransportRtu,          //QModbusRtuSerialMaster
+    eTransportTcp,          //QModbusTcpClient
+    eTransportRtuDirect     //RtuDirectMaster, plain RTU where it isn't built
+};
+
+struct ModbusSettings {
+    int parity = QSerialPort::NoParity;
+    int baud = QSerialPort::Baud19200;
+    int dataBits = QSerialPort::Data8;
+    int stopBits = QSerialPort::OneStop;
+    int responseTime = 1000;
+    int numberOfRetries = 3;
+    int coalesceGap = -1;       //merge Rr rows up to this many unread regs apart, -1 = off
+    int tcpWindow = 1;          //Modbus TCP requests kept in flight, 1 = wait for each reply
+    int pollInterval = 10;      //ms between the reads of a Poll row
+    int cacheMaxAge = 0;        //ms, Rr/Rc rows younger in the process image skip the bus, 0 = off
+    bool adaptiveTimeout = false; //learn the timeout per slave and fc, responseTime is the upper bound
+};
+
+// sPort is a serial device name for RTU clients, host:port for TCP clients
+void applyModbusSettings(QModbusClient *device, const QString &sPort, const ModbusSettings &settings);
+// pStats gets the transport's own counters where it has any, may be null
+QModbusClient *createModbusClient(ModbusTransport transport, ModbusStats *pStats, QObject *parent);
+
+#endif // MODBUSSETTINGS_H
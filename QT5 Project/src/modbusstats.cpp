@@ -0,0 +1,287 @@
+/*
+**  ModbusStats, histograms and counters
+**
+**  Bucket index of v (us):
+**    v < 32        v
+**    else          (shift+1)*32 + (v >> shift) - 32,  shift = msb(v) - 5
+**
+*/
+
+#include "modbusstats.h"
+#include "requestqueue.h"
+
+#include <QModbusClient>
+#include <QModbusReply>
+#include <QStringList>
+#include <QTextStream>
+
+static const int kSubBits = 5;
+static const int kSubCount = 1 << kSubBits;
+static const qint64 kMaxUs = Q_INT64_C(0x7FFFFFFF);
+
+static int bucketOf(qint64 llUs)
+{
+    quint64 v = static_cast<quint64>(llUs);
+    if (v < kSubCount)
+        return static_cast<int>(v);
+    int iMsb = kSubBits;
+    while (v >> (iMsb + 1))
+        iMsb++;
+    int iShift = iMsb - kSubBits;
+    return (iShift + 1)*kSubCount + static_cast<int>((v >> iShift) - kSubCount);
+}
+
+//largest value that falls in the bucket
+static qint64 bucketHigh(int iBucket)
+{
+    if (iBucket < kSubCount)
+        return iBucket;
+    int iShift = iBucket/kSubCount - 1;
+    qint64 llSub = iBucket%kSubCount + kSubCount;
+    return ((llSub + 1) << iShift) - 1;
+}
+
+void LatencyHistogram::record(qint64 llUs)
+{
+    llUs = qBound(Q_INT64_C(0), llUs, kMaxUs);
+    int iBucket = bucketOf(llUs);
+    if (iBucket >= m_listBuckets.size())
+        m_listBuckets.resize(iBucket + 1);
+    m_listBuckets[iBucket]++;
+    if (!m_llCount || (llUs < m_llMin)) m_llMin = llUs;
+    if (llUs > m_llMax) m_llMax = llUs;
+    m_llCount++;
+    m_llSum += llUs;
+}
+
+void LatencyHistogram::reset()
+{
+    m_listBuckets.clear();
+    m_llCount = m_llSum = m_llMin = m_llMax = 0;
+}
+
+qint64 LatencyHistogram::percentile(double dP) const
+{
+    if (!m_llCount)
+        return 0;
+    qint64 llRank = qMax(Q_INT64_C(1), static_cast<qint64>(dP*m_llCount + 0.5));
+    qint64 llSeen = 0;
+    for (int i = 0; i < m_listBuckets.size(); i++) {
+        llSeen += m_listBuckets.at(i);
+        if (llSeen >= llRank)
+            return qMin(bucketHigh(i), m_llMax);
+        }
+    return m_llMax;
+}
+
+QString LatencyHistogram::summary() const
+{
+    return QString("count=%1 mean=%2 min=%3 p50=%4 p95=%5 p99=%6 max=%7")
+            .arg(m_llCount).arg(mean(), 0, 'f', 0).arg(min())
+            .arg(percentile(0.50)).arg(percentile(0.95)).arg(percentile(0.99)).arg(m_llMax);
+}
+
+int AdaptiveTimeout::timeout(int key) const
+{
+    if (m_iMaxMs <= 0)
+        return 0;
+    auto it = m_mapEstimates.constFind(key);
+    if (it == m_mapEstimates.constEnd())
+        return m_iMaxMs;   //nothing seen yet
+    double dRtoMs = it->dSrttMs + qMax(1.0, 4*it->dRttvarMs);
+    dRtoMs *= (1 << qMin(it->iBackoff, 16));
+    return qBound(kMinMs, static_cast<int>(dRtoMs + 0.5), qMax(kMinMs, m_iMaxMs));
+}
+
+void AdaptiveTimeout::sample(int key, qint64 llRttUs)
+{
+    const double dRttMs = llRttUs/1000.0;
+    auto it = m_mapEstimates.find(key);
+    if (it == m_mapEstimates.end()) {
+        Estimate estimate;
+        estimate.dSrttMs = dRttMs;
+        estimate.dRttvarMs = dRttMs/2;
+        m_mapEstimates.insert(key, estimate);
+        return;
+        }
+    it->dRttvarMs += (qAbs(dRttMs - it->dSrttMs) - it->dRttvarMs)/4;
+    it->dSrttMs += (dRttMs - it->dSrttMs)/8;
+    it->iBackoff = 0;
+}
+
+void AdaptiveTimeout::timedOut(int key)
+{
+    auto it = m_mapEstimates.find(key);
+    if (it != m_mapEstimates.end())
+        it->iBackoff++;
+}
+
+//"1/03=35" = slave 1, FC03, 35 ms
+QString AdaptiveTimeout::summary() const
+{
+    if (m_iMaxMs <= 0)
+        return "off";
+    QStringList listRto;
+    for (auto it = m_mapEstimates.constBegin(); it != m_mapEstimates.constEnd(); ++it)
+        listRto << QString::asprintf("%d/%02X=%d", it.key() >> 8, it.key() & 0xFF, timeout(it.key()));
+    return listRto.join(' ');
+}
+
+ModbusStats::ModbusStats()
+{
+    m_clock.start();
+}
+
+void ModbusStats::requestSent(QModbusReply *reply, int fc, int slave, qint64 llQueuedNs)
+{
+    QMutexLocker lock(&m_mutex);
+    qint64 llNowNs = m_clock.nsecsElapsed();
+    m_counters.llRequests++;
+    m_histQueue.record((llNowNs - llQueuedNs)/1000);
+    if (reply) {
+        Pending pending;
+        pending.fc = fc;
+        pending.slave = slave;
+        pending.llSentNs = llNowNs;
+        pending.iTimeoutMs = m_rto.timeout((slave << 8) | fc);
+        m_hashPending.insert(reply, pending);
+        }
+}
+
+void ModbusStats::replyFinished(QModbusReply *reply)
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_hashPending.contains(reply))
+        return;
+    const Pending pending = m_hashPending.take(reply);
+    m_counters.llReplies++;
+    switch (reply->error()) {
+        case QModbusDevice::NoError:
+            break;
+        case QModbusDevice::TimeoutError:
+            m_counters.llTimeouts++;
+            m_rto.timedOut((pending.slave << 8) | pending.fc);
+            return; //no round trip to record
+        case QModbusDevice::ProtocolError:
+            m_counters.llExceptions++;
+            break;
+        default:
+            m_counters.llOtherErrors++;
+            return;
+        }
+    qint64 llUs = (m_clock.nsecsElapsed() - pending.llSentNs)/1000;
+    m_mapFc[pending.fc].record(llUs);
+    //Karn: a reply later than the timeout it went out with answered a retry the
+    //client made on its own, which send it answers is unknown
+    if (!pending.iTimeoutMs || (llUs < pending.iTimeoutMs*1000LL))
+        m_rto.sample((pending.slave << 8) | pending.fc, llUs);
+    m_mapSlave[pending.slave].record(llUs);
+}
+
+void ModbusStats::sendFailed()
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters.llSendErrors++;
+}
+
+void ModbusStats::retried()
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters.llRetries++;
+}
+
+void ModbusStats::crcError()
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters.llCrcErrors++;
+}
+
+void ModbusStats::cacheHit()
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters.llCacheHits++;
+}
+
+void ModbusStats::cacheMiss()
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters.llCacheMisses++;
+}
+
+void ModbusStats::queueWait(int iClass, qint64 llWaitNs, bool bLate)
+{
+    QMutexLocker lock(&m_mutex);
+    ClassWait &wait = m_mapClass[iClass];
+    wait.histWait.record(llWaitNs/1000);
+    if (bLate)
+        wait.llLate++;
+}
+
+void ModbusStats::queueDropped(int iClass)
+{
+    QMutexLocker lock(&m_mutex);
+    m_mapClass[iClass].llDropped++;
+}
+
+void ModbusStats::setAdaptiveTimeout(int iMaxMs)
+{
+    QMutexLocker lock(&m_mutex);
+    m_rto.setMax(iMaxMs);
+}
+
+int ModbusStats::responseTimeout(int fc, int slave) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_rto.timeout((slave << 8) | fc);
+}
+
+//the client has one timeout, set it right before each send
+void ModbusStats::applyTimeout(QModbusClient *device, int fc, int slave) const
+{
+    const int iTimeout = responseTimeout(fc, slave);
+    if (iTimeout > 0)
+        device->setTimeout(iTimeout);
+}
+
+//pending requests stay, their replies still count
+void ModbusStats::reset()
+{
+    QMutexLocker lock(&m_mutex);
+    m_llResetNs = m_clock.nsecsElapsed();
+    m_counters = ModbusCounters();
+    m_histQueue.reset();
+    m_mapClass.clear();
+    m_mapFc.clear();
+    m_mapSlave.clear();
+}
+
+//one "name value" or "name key=value ..." line per metric, times in us
+QString ModbusStats::report() const
+{
+    QMutexLocker lock(&m_mutex);
+    QString sReport;
+    QTextStream out(&sReport);
+    out << "uptime_s " << QString::number((m_clock.nsecsElapsed() - m_llResetNs)/1e9, 'f', 1) << "\n"
+        << "requests " << m_counters.llRequests << "\n"
+        << "replies " << m_counters.llReplies << "\n"
+        << "in_flight " << m_hashPending.size() << "\n"
+        << "timeouts " << m_counters.llTimeouts << "\n"
+        << "retries " << m_counters.llRetries << "\n"
+        << "crc_errors " << m_counters.llCrcErrors << "\n"
+        << "exceptions " << m_counters.llExceptions << "\n"
+        << "send_errors " << m_counters.llSendErrors << "\n"
+        << "other_errors " << m_counters.llOtherErrors << "\n"
+        << "cache_hits " << m_counters.llCacheHits << "\n"
+        << "cache_misses " << m_counters.llCacheMisses << "\n"
+        << "queue_us " << m_histQueue.summary() << "\n"
+        << "rto_ms " << m_rto.summary() << "\n";
+    for (auto it = m_mapClass.constBegin(); it != m_mapClass.constEnd(); ++it)
+        out << "queue_" << RequestQueue::name(it.key()) << "_us " << it.value().histWait.summary()
+            << " late=" << it.value().llLate << " dropped=" << it.value().llDropped << "\n";
+    for (auto it = m_mapFc.constBegin(); it != m_mapFc.constEnd(); ++it)
+        out << "fc" << QString("%1").arg(it.key(), 2, 16, QChar('0')) << "_us " << it.value().summary() << "\n";
+    for (auto it = m_mapSlave.constBegin(); it != m_mapSlave.constEnd(); ++it)
+        out << "slave" << it.key() << "_us " << it.value().summary() << "\n";
+    out.flush();
+    return sReport;
+}
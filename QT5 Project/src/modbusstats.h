@@ -0,0 +1,139 @@
+/****************************************************************************
+**
+** ModbusStats
+**
+**  Request instrumentation shared by the executor, the scheduler and the
+**  manual sends. Every request is stamped when it is queued, when it is
+**  handed to the client and when its reply is in; queue wait and round
+**  trip go into log-linear (HDR style) histograms, round trips per
+**  function code and per slave, queue wait also per RequestQueue
+**  priority class. Writers are the Modbus thread, report()
+**  may be called from any thread.
+**
+****************************************************************************/
+
+#ifndef MODBUSSTATS_H
+#define MODBUSSTATS_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+QT_END_NAMESPACE
+
+//32 linear sub-buckets per power of two, about 3% resolution
+class LatencyHistogram
+{
+public:
+    void record(qint64 llUs);
+    void reset();
+    qint64 count() const { return m_llCount; }
+    qint64 min() const { return m_llCount ? m_llMin : 0; }
+    qint64 max() const { return m_llMax; }
+    double mean() const { return m_llCount ? double(m_llSum)/m_llCount : 0.0; }
+    qint64 percentile(double dP) const;
+    QString summary() const;
+
+private:
+    QVector<quint32> m_listBuckets;
+    qint64 m_llCount = 0;
+    qint64 m_llSum = 0;
+    qint64 m_llMin = 0;
+    qint64 m_llMax = 0;
+};
+
+//RFC 6298 style response timeout per slave and function code:
+//  srtt += (r - srtt)/8, rttvar += (|r - srtt| - rttvar)/4, rto = srtt + 4*rttvar
+//clamped to [kMinMs, max], each timeout doubles it until the next reply;
+//replies that needed a retry are not sampled (Karn)
+class AdaptiveTimeout
+{
+public:
+    static const int kMinMs = 20;
+
+    void setMax(int iMaxMs) { m_iMaxMs = iMaxMs; }
+    int timeout(int key) const;
+    void sample(int key, qint64 llRttUs);
+    void timedOut(int key);
+    QString summary() const;
+
+private:
+    struct Estimate {
+        double dSrttMs = 0;
+        double dRttvarMs = 0;
+        int iBackoff = 0;
+    };
+    QMap<int, Estimate> m_mapEstimates;
+    int m_iMaxMs = 0;       //0 = off
+};
+
+struct ModbusCounters
+{
+    qint64 llRequests = 0;
+    qint64 llReplies = 0;
+    qint64 llTimeouts = 0;
+    qint64 llRetries = 0;
+    qint64 llCrcErrors = 0;
+    qint64 llExceptions = 0;
+    qint64 llSendErrors = 0;
+    qint64 llOtherErrors = 0;
+    qint64 llCacheHits = 0;
+    qint64 llCacheMisses = 0;
+};
+
+class ModbusStats
+{
+public:
+    ModbusStats();
+
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+    void requestSent(QModbusReply *reply, int fc, int slave, qint64 llQueuedNs);
+    void replyFinished(QModbusReply *reply);
+    void sendFailed();
+    void retried();
+    void crcError();
+    void cacheHit();
+    void cacheMiss();
+    //RequestQueue, per priority class: bLate = sent after its deadline
+    void queueWait(int iClass, qint64 llWaitNs, bool bLate);
+    void queueDropped(int iClass);
+    //iMaxMs = the configured timeout, 0 = keep it fixed
+    void setAdaptiveTimeout(int iMaxMs);
+    //ms to use for the next request, 0 = adaptive timeout off
+    int responseTimeout(int fc, int slave) const;
+    void applyTimeout(QModbusClient *device, int fc, int slave) const;
+    void reset();
+    QString report() const;
+
+private:
+    struct Pending {
+        int fc;
+        int slave;
+        qint64 llSentNs;
+        int iTimeoutMs;     //adaptive timeout at send, 0 = off
+    };
+    struct ClassWait {
+        LatencyHistogram histWait;
+        qint64 llLate = 0;
+        qint64 llDropped = 0;
+    };
+
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    qint64 m_llResetNs = 0;
+    QHash<QModbusReply *, Pending> m_hashPending;
+    ModbusCounters m_counters;
+    LatencyHistogram m_histQueue;
+    QMap<int, ClassWait> m_mapClass;
+    QMap<int, LatencyHistogram> m_mapFc;
+    QMap<int, LatencyHistogram> m_mapSlave;
+    AdaptiveTimeout m_rto;
+};
+
+#endif // MODBUSSTATS_H
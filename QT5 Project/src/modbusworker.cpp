@@ -0,0 +1,351 @@
+/****************************************************************************
+**
+** ModbusWorker
+**
+**  Everything in here runs on the Modbus thread, except popEvent(),
+**  clearPending() and takeDropped() which belong to the UI thread.
+**
+****************************************************************************/
+
+#include "modbusworker.h"
+#include "scriptexecutor.h"
+#include "pollscheduler.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QModbusClient>
+#include <QDebug>
+
+ModbusWorker::ModbusWorker(QObject *parent)
+    : QObject(parent)
+    , m_pScript(new ScriptExecutor(this))
+    , m_pScheduler(new PollScheduler(this))
+    , m_pQueue(new RequestQueue(this))
+{
+    connect(m_pScript, &ScriptExecutor::rowStarted, this, [this](int row) {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eRowStarted;
+        ev.iValue = row;
+        pushEvent(ev);
+        });
+    connect(m_pScript, &ScriptExecutor::message, this, [this](const QString &sMsg) {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eMessage;
+        ev.sText = sMsg;
+        pushEvent(ev);
+        });
+    connect(m_pScript, &ScriptExecutor::replyReady, this, &ModbusWorker::pushReply);
+    connect(m_pScript, &ScriptExecutor::cachedReady, this, &ModbusWorker::pushCached);
+    connect(m_pScript, &ScriptExecutor::loopStarted, this, [this](int iLoop) {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eLoopStarted;
+        ev.iValue = iLoop;
+        pushEvent(ev);
+        });
+    connect(m_pScript, &ScriptExecutor::loopFinished, this, [this](int iLoopsLeft) {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eLoopFinished;
+        ev.iValue = iLoopsLeft;
+        pushEvent(ev);
+        });
+    connect(m_pScript, &ScriptExecutor::finished, this, [this]() {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eFinished;
+        pushEvent(ev);
+        });
+
+    m_pQueue->setStats(&m_stats);
+    m_pScript->setStats(&m_stats);
+    m_pScript->setQueue(m_pQueue);
+    m_pScheduler->setStats(&m_stats);
+    m_pScheduler->setQueue(m_pQueue);
+    m_pScheduler->setReportInterval(2000);
+    connect(m_pScheduler, &PollScheduler::rowStarted, this, [this](int row) {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eRowStarted;
+        ev.iValue = row;
+        pushEvent(ev);
+        });
+    connect(m_pScheduler, &PollScheduler::message, this, [this](const QString &sMsg) {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eMessage;
+        ev.sText = sMsg;
+        pushEvent(ev);
+        });
+    connect(m_pScheduler, &PollScheduler::replyReady, this, &ModbusWorker::pushReply);
+    connect(m_pScheduler, &PollScheduler::finished, this, [this]() {
+        ModbusEvent ev;
+        ev.type = ModbusEvent::eFinished;
+        pushEvent(ev);
+        });
+}
+
+ModbusWorker::~ModbusWorker()
+{
+    if (modbusDevice)
+        modbusDevice->disconnectDevice();
+    delete modbusDevice;
+}
+
+//Producer side: only the first event after the UI drained posts a wakeup
+void ModbusWorker::pushEvent(const ModbusEvent &ev)
+{
+    if (!m_ringEvents.push(ev)) {
+        m_iDropped++; //UI stalled, never block the bus for the console
+        return;
+        }
+    if (!m_bPending.exchange(true))
+        emit eventsPending();
+}
+
+void ModbusWorker::pushReply(int row, QModbusReply *reply, const QModbusDataUnit &unit)
+{
+    ModbusEvent ev;
+    ev.type = ModbusEvent::eReply;
+    ev.iValue = row;
+    ev.error = reply->error();
+    if (ev.error != QModbusDevice::NoError) {
+        ev.sText = reply->errorString();
+        ev.iException = reply->rawResult().exceptionCode();
+        }
+    else {
+        m_image.update(reply->serverAddress(), unit);
+        if (m_logger.isOpen())
+            m_logger.record(reply->serverAddress(), unit);
+        }
+    ev.unit = unit;
+    pushEvent(ev);
+}
+
+//A read answered from the process image, sText tells the console
+void ModbusWorker::pushCached(int row, const QModbusDataUnit &unit)
+{
+    ModbusEvent ev;
+    ev.type = ModbusEvent::eReply;
+    ev.iValue = row;
+    ev.sText = "cached";
+    ev.unit = unit;
+    pushEvent(ev);
+}
+
+bool ModbusWorker::readCached(int iServerAddr, QModbusDataUnit &unit)
+{
+    if (m_iCacheAge <= 0)
+        return false;
+    if (!m_image.read(iServerAddr, unit, m_iCacheAge)) {
+        m_stats.cacheMiss();
+        return false;
+        }
+    m_stats.cacheHit();
+    pushCached(-1, unit);
+    return true;
+}
+
+//Consumer side: clear the flag first, then drain until empty
+void ModbusWorker::clearPending()
+{
+    m_bPending.store(false);
+}
+
+bool ModbusWorker::popEvent(ModbusEvent &ev)
+{
+    return m_ringEvents.pop(ev);
+}
+
+int ModbusWorker::takeDropped()
+{
+    return m_iDropped.exchange(0);
+}
+
+void ModbusWorker::createDevice(int transport)
+{
+    m_pScript->setDevice(nullptr);
+    m_pScheduler->setDevice(nullptr);
+    m_pQueue->setDevice(nullptr);
+    if (modbusDevice) {
+        modbusDevice->disconnectDevice();
+        delete modbusDevice;
+        modbusDevice = nullptr;
+        }
+
+    modbusDevice = createModbusClient(static_cast<ModbusTransport>(transport), &m_stats, this);
+
+    connect(modbusDevice, &QModbusClient::errorOccurred, this, [this](QModbusDevice::Error) {
+        emit errorOccurred(modbusDevice->errorString());
+        });
+    connect(modbusDevice, &QModbusClient::stateChanged, this, [this](QModbusDevice::State state) {
+        emit stateChanged(state);
+        });
+    m_pScript->setDevice(modbusDevice);
+    m_pScheduler->setDevice(modbusDevice);
+    m_pQueue->setDevice(modbusDevice);
+}
+
+void ModbusWorker::connectDevice(const QString &sPort, const ModbusSettings &settings)
+{
+    if (!modbusDevice)
+        return;
+
+    applyModbusSettings(modbusDevice, sPort, settings);
+    m_image.clear();    //another port may be another device
+    m_iCacheAge = settings.cacheMaxAge;
+    m_stats.setAdaptiveTimeout(settings.adaptiveTimeout ? settings.responseTime : 0);
+    m_pScript->setCache(&m_image, m_iCacheAge);
+    qDebug() << settings.responseTime << settings.numberOfRetries;
+    if (!modbusDevice->connectDevice())
+        emit errorOccurred(tr("Connect failed: ") + modbusDevice->errorString());
+}
+
+void ModbusWorker::disconnectDevice()
+{
+    m_pScript->stop();
+    m_pScheduler->stop();
+    m_pQueue->cancel(this);
+    if (modbusDevice)
+        modbusDevice->disconnectDevice();
+}
+
+void ModbusWorker::runScript(const ModbusProgram &program, int iLoops, int iServerAddr, bool bDryRun, int iWindow, int iPollInterval)
+{
+    if (m_pScript->isRunning() || m_pScheduler->isRunning())
+        return;
+    m_pScript->setScript(program);
+    m_pScript->setWindow(iWindow);
+    m_pQueue->setWindow(iWindow);
+    m_pScript->setPollInterval(iPollInterval);
+    m_pScript->start(iLoops, iServerAddr, bDryRun);
+}
+
+void ModbusWorker::runSchedule(const ModbusProgram &program, int iServerAddr, bool bDryRun)
+{
+    if (m_pScript->isRunning() || m_pScheduler->isRunning())
+        return;
+    m_pScheduler->setScript(program);
+    m_pQueue->setWindow(1);
+    m_pScheduler->start(iServerAddr, bDryRun);
+}
+
+void ModbusWorker::stopScript()
+{
+    m_pScript->stop();
+    m_pScheduler->stop();
+}
+
+void ModbusWorker::sendManual(const ModbusOp &op, int iServerAddr)
+{
+    m_pQueue->submit(this, RequestQueue::eAction, op, iServerAddr, [this](QModbusReply *reply, bool) {
+        if (!reply) {
+            emit errorOccurred(tr("Send error: ") + (modbusDevice ? modbusDevice->errorString() : QString()));
+            return;
+            }
+        if (!reply->isFinished())
+            connect(reply, &QModbusReply::finished, this, &ModbusWorker::readReady);
+        else
+            delete reply; // broadcast replies return immediately
+        });
+}
+
+void ModbusWorker::readReady()
+{
+    auto reply = qobject_cast<QModbusReply *>(sender());
+    if (!reply) return;
+
+    m_stats.replyFinished(reply);
+    //FC23 results hold the read half only, the write is confirmed by NoError
+    pushReply(-1, reply, reply->result());
+    reply->deleteLater();
+}
+
+void ModbusWorker::regRead(int iServerAddr, int iRegAddr, quint16 iRegCount)
+{
+    if (!modbusDevice) return;
+    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, iRegCount);
+    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
+    if (readCached(iServerAddr, du))
+        return;
+    ModbusOp op;
+    op.fc = 0x03;
+    op.unit = du;
+    sendManual(op, iServerAddr);
+}
+
+void ModbusWorker::regsWrite(int iServerAddr, int iRegAddr, const QVector<quint16> &data)
+{
+    if (!modbusDevice) return;
+    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iRegAddr, data);
+    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
+    ModbusOp op;
+    op.fc = (data.size() == 1) ? 0x06 : 0x10;
+    op.unit = du;
+    sendManual(op, iServerAddr);
+}
+
+void ModbusWorker::regsReadWrite(int iServerAddr, int iReadAddr, quint16 iReadCount, int iWriteAddr, const QVector<quint16> &data)
+{
+    if (!modbusDevice) return;
+    QModbusDataUnit duRead = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iReadAddr, iReadCount);
+    QModbusDataUnit duWrite = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, iWriteAddr, data);
+    qDebug() << __FUNCTION__ << QString::number(duWrite.startAddress(),16).toUpper() << duWrite.values()
+             << QString::number(duRead.startAddress(),16).toUpper() << iReadCount;
+    ModbusOp op;
+    op.fc = 0x17;
+    op.unit = duWrite;
+    op.unitRead = duRead;
+    sendManual(op, iServerAddr);
+}
+
+void ModbusWorker::coilWrite(int iServerAddr, int iCoilAddr, const QVector<quint16> &data)
+{
+    if (!modbusDevice) return;
+    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::Coils, iCoilAddr, data);
+    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
+    ModbusOp op;
+    op.fc = (data.size() == 1) ? 0x05 : 0x0F;
+    op.unit = du;
+    sendManual(op, iServerAddr);
+}
+
+void ModbusWorker::coilRead(int iServerAddr, int iCoilAddr, quint16 iCoilCount)
+{
+    if (!modbusDevice) return;
+    QModbusDataUnit du = QModbusDataUnit(QModbusDataUnit::DiscreteInputs, iCoilAddr, iCoilCount);
+    qDebug() << __FUNCTION__ << QString::number(du.startAddress(),16).toUpper() << du.values();
+    if (readCached(iServerAddr, du))
+        return;
+    ModbusOp op;
+    op.fc = 0x02;
+    op.unit = du;
+    sendManual(op, iServerAddr);
+}
+
+void ModbusWorker::startLog(const QString &sFilename)
+{
+    QString sError;
+    if (!m_logger.open(sFilename, sError))
+        emit errorOccurred(tr("Data log: ") + sError);
+}
+
+void ModbusWorker::stopLog()
+{
+    m_logger.close();
+}
+
+//each connection gets one text snapshot, then it is closed
+void ModbusWorker::startStatsServer(const QString &sName)
+{
+    if (m_pStatsServer)
+        return;
+    m_pStatsServer = new QLocalServer(this);
+    QLocalServer::removeServer(sName);
+    if (!m_pStatsServer->listen(sName)) {
+        emit errorOccurred(tr("Stats socket: ") + m_pStatsServer->errorString());
+        return;
+        }
+    connect(m_pStatsServer, &QLocalServer::newConnection, this, [this]() {
+        while (QLocalSocket *pSocket = m_pStatsServer->nextPendingConnection()) {
+            connect(pSocket, &QLocalSocket::disconnected, pSocket, &QObject::deleteLater);
+            pSocket->write(m_stats.report().toUtf8());
+            pSocket->disconnectFromServer();
+            }
+        });
+}
@@ -0,0 +1,119 @@
+/****************************************************************************
+**
+** ModbusWorker
+**
+**  Owns the QModbusClient and the ScriptExecutor on a dedicated QThread,
+**  so table repaints and console appends never delay reply handling.
+**  Calls come in as queued functors, console/reply events go back to the
+**  UI through a lock-free ring with a single coalesced eventsPending().
+**  Request stats are served as text on a local socket from this thread,
+**  so a busy GUI never blocks the scraper. Successful replies can also be
+**  recorded to a binary data log, see DataLogger, and all of them land
+**  in the per-slave ProcessImage. Script, schedule and manual sends
+**  share one RequestQueue, manual sends in the action class, so they
+**  overtake background polling at the next frame.
+**
+****************************************************************************/
+
+#ifndef MODBUSWORKER_H
+#define MODBUSWORKER_H
+
+#include <QObject>
+#include <QModbusDevice>
+#include <QModbusDataUnit>
+#include <atomic>
+
+#include "modbusscript.h"
+#include "modbussettings.h"
+#include "modbusstats.h"
+#include "datalogger.h"
+#include "processimage.h"
+#include "requestqueue.h"
+#include "spscring.h"
+
+QT_BEGIN_NAMESPACE
+class QLocalServer;
+class QModbusClient;
+class QModbusReply;
+QT_END_NAMESPACE
+
+class ScriptExecutor;
+class PollScheduler;
+
+struct ModbusEvent
+{
+    enum Type { eRowStarted, eMessage, eReply, eLoopStarted, eLoopFinished, eFinished };
+
+    Type    type = eMessage;
+    int     iValue = 0;     //row, -1 for manual sends, or loop count
+    QString sText;          //message, reply error string or "cached"
+    QModbusDevice::Error error = QModbusDevice::NoError;
+    int     iException = 0;
+    QModbusDataUnit unit;
+};
+
+class ModbusWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ModbusWorker(QObject *parent = nullptr);
+    ~ModbusWorker();
+
+    //UI thread side of the event ring
+    bool popEvent(ModbusEvent &ev);
+    void clearPending();
+    int takeDropped();
+    //thread safe
+    ModbusStats *stats() { return &m_stats; }
+    ProcessImage *processImage() { return &m_image; }
+
+public slots:
+    void createDevice(int transport);   //ModbusTransport
+    void connectDevice(const QString &sPort, const ModbusSettings &settings);
+    void disconnectDevice();
+    void runScript(const ModbusProgram &program, int iLoops, int iServerAddr, bool bDryRun, int iWindow, int iPollInterval);
+    void runSchedule(const ModbusProgram &program, int iServerAddr, bool bDryRun);
+    void stopScript();
+
+    void regRead(int iServerAddr, int iRegAddr, quint16 iRegCount);
+    void regsWrite(int iServerAddr, int iRegAddr, const QVector<quint16> &data);
+    void regsReadWrite(int iServerAddr, int iReadAddr, quint16 iReadCount, int iWriteAddr, const QVector<quint16> &data);
+    void coilWrite(int iServerAddr, int iCoilAddr, const QVector<quint16> &data);
+    void coilRead(int iServerAddr, int iCoilAddr, quint16 iCoilCount);
+
+    void startStatsServer(const QString &sName);
+    void startLog(const QString &sFilename);
+    void stopLog();
+
+signals:
+    void eventsPending();
+    void stateChanged(int state);
+    void errorOccurred(const QString &sError);
+
+private slots:
+    void readReady();
+
+private:
+    void pushEvent(const ModbusEvent &ev);
+    void pushReply(int row, QModbusReply *reply, const QModbusDataUnit &unit);
+    void pushCached(int row, const QModbusDataUnit &unit);
+    bool readCached(int iServerAddr, QModbusDataUnit &unit);
+    void sendManual(const ModbusOp &op, int iServerAddr);
+
+    QModbusClient *modbusDevice = nullptr;
+    ScriptExecutor *m_pScript;
+    PollScheduler *m_pScheduler;
+    RequestQueue *m_pQueue;
+    ModbusStats m_stats;
+    QLocalServer *m_pStatsServer = nullptr;
+    DataLogger m_logger;
+    ProcessImage m_image;
+    int m_iCacheAge = 0;    //ms, 0 = every read goes to the bus
+
+    SpscRing<ModbusEvent, 1024> m_ringEvents;
+    std::atomic<bool> m_bPending{false};
+    std::atomic<int> m_iDropped{0};
+};
+
+#endif // MODBUSWORKER_H
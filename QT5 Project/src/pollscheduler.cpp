@@ -0,0 +1,267 @@
+/****************************************************************************
+**
+** PollScheduler
+**
+**  Earliest deadline first over the cyclic rows, one request on the bus
+**  at a time:
+**    reply in -> pick the task with the smallest deadline -> due ? send
+**                                                          : sleep until due
+**  A task that fell a full period behind drops the missed releases
+**  (counted as late) instead of bursting to catch up.
+**
+****************************************************************************/
+
+#include "pollscheduler.h"
+
+#include <QModbusClient>
+#include <QModbusReply>
+#include <QMap>
+#include <QDebug>
+
+PollScheduler::PollScheduler(QObject *parent)
+    : QObject(parent)
+    , m_pOwnQueue(new RequestQueue(this))
+    , m_pQueue(m_pOwnQueue)
+    , m_timerIdle(this)
+    , m_timerReport(this)
+{
+    m_timerIdle.setSingleShot(true);
+    m_timerIdle.setTimerType(Qt::PreciseTimer);
+    connect(&m_timerIdle, &QTimer::timeout, this, &PollScheduler::dispatch);
+    connect(&m_timerReport, &QTimer::timeout, this, [this]() {
+        emit message(report());
+        });
+}
+
+void PollScheduler::setDevice(QModbusClient *device)
+{
+    if (m_bRunning)
+        stop();
+    modbusDevice = device;
+    m_pOwnQueue->setDevice(device);
+}
+
+void PollScheduler::setStats(ModbusStats *pStats)
+{
+    m_pStats = pStats;
+    m_pOwnQueue->setStats(pStats);
+}
+
+//nullptr = back to the private queue
+void PollScheduler::setQueue(RequestQueue *pQueue)
+{
+    if (m_bRunning)
+        stop();
+    m_pQueue = pQueue ? pQueue : m_pOwnQueue;
+}
+
+void PollScheduler::setScript(const ModbusProgram &program)
+{
+    m_program = program;
+}
+
+//0 = only on stop()
+void PollScheduler::setReportInterval(int iInterval)
+{
+    m_timerReport.setInterval(iInterval);
+}
+
+void PollScheduler::start(int iServerAddr, bool bDryRun)
+{
+    if (m_bRunning)
+        return;
+
+    m_bDryRun = bDryRun;
+    m_listTasks.clear();
+    for (int i = 0; i < m_program.size(); i++) {
+        const ModbusOp &op = m_program.at(i);
+        if (!op.bRun || !op.fc || (op.period <= 0))
+            continue;
+        PollTask task;
+        task.iOp = i;
+        task.iServerAddr = op.slave ? op.slave : iServerAddr;
+        task.llPeriodNs = op.period * 1000000LL;
+        m_listTasks.append(task);
+        }
+    if (m_listTasks.isEmpty() || (!m_bDryRun && !modbusDevice)) {
+        emit finished();
+        return;
+        }
+
+    m_bRunning = true;
+    m_clock.start();    //every task is due at 0
+    if (m_timerReport.interval() > 0)
+        m_timerReport.start();
+    dispatch();
+}
+
+void PollScheduler::stop()
+{
+    if (!m_bRunning)
+        return;
+
+    m_bRunning = false;
+    m_timerIdle.stop();
+    m_timerReport.stop();
+    m_pQueue->cancel(this);
+    m_bQueued = false;
+    if (m_pReply) {
+        disconnect(m_pReply, nullptr, this, nullptr);
+        connect(m_pReply, &QModbusReply::finished, m_pReply, &QObject::deleteLater);
+        m_pReply = nullptr;
+        }
+    emit message(report());
+    emit finished();
+}
+
+//ties go to the shorter period
+int PollScheduler::earliestTask() const
+{
+    int iBest = 0;
+    for (int i = 1; i < m_listTasks.size(); i++) {
+        const PollTask &task = m_listTasks.at(i);
+        const PollTask &best = m_listTasks.at(iBest);
+        if ((task.llDueNs < best.llDueNs)
+                || ((task.llDueNs == best.llDueNs) && (task.llPeriodNs < best.llPeriodNs)))
+            iBest = i;
+        }
+    return iBest;
+}
+
+void PollScheduler::dispatch()
+{
+    if (!m_bRunning || m_pReply || m_bQueued)
+        return;
+
+    const int iTask = earliestTask();
+    PollTask &task = m_listTasks[iTask];
+    const qint64 llNowNs = m_clock.nsecsElapsed();
+    if (task.llDueNs > llNowNs) {
+        m_timerIdle.start(static_cast<int>((task.llDueNs - llNowNs + 999999)/1000000));
+        return;
+        }
+
+    const qint64 llLateNs = llNowNs - task.llDueNs;   //queue wait behind the deadline
+    if (llLateNs >= task.llPeriodNs) {
+        task.iLate += static_cast<int>(llLateNs/task.llPeriodNs);
+        task.llDueNs = llNowNs + task.llPeriodNs;
+        }
+    else {
+        task.llDueNs += task.llPeriodNs;
+        }
+
+    const ModbusOp &op = m_program.at(task.iOp);
+    if (op.slices.isEmpty()) {
+        emit rowStarted(op.row);
+        }
+    else {
+        for (const ModbusSlice &slice : op.slices)
+            emit rowStarted(slice.row);
+        }
+    if (m_bDryRun) {
+        task.iReplies++;
+        m_timerIdle.start(0);
+        return;
+        }
+
+    //by the next release this one is worth nothing
+    m_bQueued = true;
+    m_pQueue->submit(this, RequestQueue::priorityOf(op, RequestQueue::ePoll), op, task.iServerAddr,
+                     [this, iTask](QModbusReply *reply, bool bExpired) {
+        m_bQueued = false;
+        PollTask &task = m_listTasks[iTask];
+        if (!reply) {
+            if (bExpired) {
+                task.iLate++;
+                }
+            else {
+                task.iErrors++;
+                emit message(tr("Send error: ") + (modbusDevice ? modbusDevice->errorString() : QString()));
+                }
+            m_timerIdle.start(0);
+            return;
+            }
+        emit requestSent(m_program.at(task.iOp).row, reply);
+        if (reply->isFinished()) {
+            delete reply; // broadcast replies return immediately
+            m_timerIdle.start(0);
+            return;
+            }
+        m_pReply = reply;
+        m_iTask = iTask;
+        m_llSentNs = m_clock.nsecsElapsed();
+        connect(reply, &QModbusReply::finished, this, &PollScheduler::onReplyFinished);
+        }, static_cast<int>(task.llPeriodNs/1000000));
+}
+
+void PollScheduler::onReplyFinished()
+{
+    auto reply = qobject_cast<QModbusReply *>(sender());
+    if (!reply) return;
+    if (m_pStats)
+        m_pStats->replyFinished(reply);
+    if (reply != m_pReply) {
+        reply->deleteLater();
+        return;
+        }
+    m_pReply = nullptr;
+
+    PollTask &task = m_listTasks[m_iTask];
+    task.iReplies++;
+    task.llBusyNs += m_clock.nsecsElapsed() - m_llSentNs;
+    if (reply->error() != QModbusDevice::NoError)
+        task.iErrors++;
+
+    const ModbusOp &op = m_program.at(task.iOp);
+    const QModbusDataUnit unit = reply->result();
+    if (op.slices.isEmpty()) {
+        emit replyReady(op.row, reply, unit);
+        }
+    else {
+        for (const ModbusSlice &slice : op.slices)
+            emit replyReady(slice.row, reply, ModbusScript::sliceUnit(unit, slice));
+        }
+    reply->deleteLater();
+
+    //back to back, the next due request goes out from the reply handler
+    dispatch();
+}
+
+QString PollScheduler::report() const
+{
+    struct SlaveRate {
+        int iRows = 0;
+        double dWanted = 0;
+        int iReplies = 0;
+        int iErrors = 0;
+        int iLate = 0;
+        qint64 llBusyNs = 0;
+    };
+    QMap<int, SlaveRate> mapSlaves;
+    for (const PollTask &task : m_listTasks) {
+        SlaveRate &rate = mapSlaves[task.iServerAddr];
+        rate.iRows++;
+        rate.dWanted += 1e9/task.llPeriodNs;
+        rate.iReplies += task.iReplies;
+        rate.iErrors += task.iErrors;
+        rate.iLate += task.iLate;
+        rate.llBusyNs += task.llBusyNs;
+        }
+
+    const qint64 llElapsedNs = qMax(Q_INT64_C(1), m_clock.isValid() ? m_clock.nsecsElapsed() : 0);
+    QString sReport = QString("slave rows  want/s   got/s  ratio   err  late  busy%");
+    qint64 llBusyNs = 0;
+    for (auto it = mapSlaves.constBegin(); it != mapSlaves.constEnd(); ++it) {
+        const SlaveRate &rate = it.value();
+        double dGot = rate.iReplies*1e9/llElapsedNs;
+        sReport += QString("\n%1 %2 %3 %4 %5 %6 %7 %8")
+                .arg(it.key(), 5).arg(rate.iRows, 4)
+                .arg(rate.dWanted, 7, 'f', 1).arg(dGot, 7, 'f', 1)
+                .arg(rate.dWanted > 0 ? dGot/rate.dWanted : 0.0, 6, 'f', 2)
+                .arg(rate.iErrors, 5).arg(rate.iLate, 5)
+                .arg(rate.llBusyNs*100.0/llElapsedNs, 6, 'f', 1);
+        llBusyNs += rate.llBusyNs;
+        }
+    sReport += QString("\nbus busy %1%").arg(llBusyNs*100.0/llElapsedNs, 0, 'f', 1);
+    return sReport;
+}
@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** PollScheduler
+**
+**  Cyclic polling of several slaves on one bus. Every CSV row with a
+**  Period(ms) becomes a task; the task with the earliest deadline goes out
+**  as soon as the previous reply is in, so the bus only idles when
+**  nothing is due. Reports achieved against requested rate per slave.
+**  Releases go through a RequestQueue in the poll class (or the row's
+**  own) with one period as deadline, so actions sharing the queue go
+**  first and a release that waited a whole period is dropped as late.
+**
+****************************************************************************/
+
+#ifndef POLLSCHEDULER_H
+#define POLLSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include "modbusscript.h"
+#include "modbusstats.h"
+#include "requestqueue.h"
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+QT_END_NAMESPACE
+
+struct PollTask
+{
+    int    iOp = -1;        //index into the program
+    int    iServerAddr = 1;
+    qint64 llPeriodNs = 0;
+    qint64 llDueNs = 0;     //next release on the scheduler clock
+    int    iReplies = 0;
+    int    iErrors = 0;
+    int    iLate = 0;       //releases skipped because the bus was saturated
+    qint64 llBusyNs = 0;    //send to reply, summed
+};
+Q_DECLARE_TYPEINFO(PollTask, Q_MOVABLE_TYPE);
+
+class PollScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PollScheduler(QObject *parent = nullptr);
+
+    void setDevice(QModbusClient *device);
+    void setScript(const ModbusProgram &program);
+    void setReportInterval(int iInterval);
+    void setStats(ModbusStats *pStats);
+    void setQueue(RequestQueue *pQueue);
+    bool isRunning() const { return m_bRunning; }
+    QString report() const;
+
+public slots:
+    void start(int iServerAddr, bool bDryRun);
+    void stop();
+
+signals:
+    void rowStarted(int row);
+    void message(const QString &sMsg);
+    void requestSent(int row, QModbusReply *reply);
+    void replyReady(int row, QModbusReply *reply, const QModbusDataUnit &unit);
+    void finished();
+
+private slots:
+    void dispatch();
+    void onReplyFinished();
+
+private:
+    int earliestTask() const;
+
+    QModbusClient *modbusDevice = nullptr;
+    ModbusStats *m_pStats = nullptr;
+    RequestQueue *m_pOwnQueue;
+    RequestQueue *m_pQueue;
+    ModbusProgram m_program;
+    QVector<PollTask> m_listTasks;
+    QElapsedTimer m_clock;
+    QTimer m_timerIdle;         //sleeps until the next deadline
+    QTimer m_timerReport;       //both children, moveToThread() takes them along
+
+    QModbusReply *m_pReply = nullptr;
+    bool m_bQueued = false;     //submitted, m_pReply not there yet
+    int m_iTask = -1;           //task of m_pReply
+    qint64 m_llSentNs = 0;
+    bool m_bRunning = false;
+    bool m_bDryRun = true;
+};
+
+#endif // POLLSCHEDULER_H
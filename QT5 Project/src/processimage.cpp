@@ -0,0 +1,113 @@
+#include "processimage.h"
+
+ProcessImage::ProcessImage()
+{
+    m_clock.start();
+}
+
+void ProcessImage::update(int slave, const QModbusDataUnit &unit)
+{
+    const int iCount = qMin(static_cast<int>(unit.valueCount()), unit.values().size());
+    if ((unit.registerType() == QModbusDataUnit::Invalid) || (iCount <= 0))
+        return;
+
+    //FC05 replies carry 0xFF00, FC01/02 reads 0/1: bit tables keep 0/1
+    const bool bBits = (unit.registerType() == QModbusDataUnit::Coils)
+            || (unit.registerType() == QModbusDataUnit::DiscreteInputs);
+    const qint64 llNowMs = now();
+    QWriteLocker lock(&m_lock);
+    Page *pPage = nullptr;
+    for (int i = 0; i < iCount; i++) {
+        const int address = (unit.startAddress() + i) & 0xFFFF;
+        const int iSlot = address & (kPageSize - 1);
+        if (!pPage || (iSlot == 0)) {
+            QSharedPointer<Page> &page = m_hashPages[pageKey(slave, unit.registerType(), address)];
+            if (!page) {
+                page.reset(new Page);
+                page->valid.reset();
+                page->dirty.reset();
+                }
+            pPage = page.data();
+            }
+        const quint16 value = bBits ? (unit.value(i) ? 1 : 0) : unit.value(i);
+        if (!pPage->valid[iSlot] || (pPage->values[iSlot] != value))
+            pPage->dirty[iSlot] = true;
+        pPage->values[iSlot] = value;
+        pPage->stamps[iSlot] = llNowMs;
+        pPage->valid[iSlot] = true;
+        }
+}
+
+bool ProcessImage::value(int slave, QModbusDataUnit::RegisterType type, int address,
+                         quint16 &value, qint64 *pllStampMs) const
+{
+    QReadLocker lock(&m_lock);
+    const QSharedPointer<Page> page = m_hashPages.value(pageKey(slave, type, address));
+    const int iSlot = address & (kPageSize - 1);
+    if (!page || !page->valid[iSlot])
+        return false;
+    value = page->values[iSlot];
+    if (pllStampMs)
+        *pllStampMs = page->stamps[iSlot];
+    return true;
+}
+
+bool ProcessImage::read(int slave, QModbusDataUnit &unit, qint64 llMaxAgeMs) const
+{
+    const int iCount = static_cast<int>(unit.valueCount());
+    const qint64 llOldestMs = (llMaxAgeMs < 0) ? Q_INT64_C(-1) : now() - llMaxAgeMs;
+    QVector<quint16> values(iCount);
+    QReadLocker lock(&m_lock);
+    const Page *pPage = nullptr;
+    for (int i = 0; i < iCount; i++) {
+        const int address = (unit.startAddress() + i) & 0xFFFF;
+        const int iSlot = address & (kPageSize - 1);
+        if (!pPage || (iSlot == 0)) {
+            pPage = m_hashPages.value(pageKey(slave, unit.registerType(), address)).data();
+            if (!pPage)
+                return false;
+            }
+        if (!pPage->valid[iSlot] || (pPage->stamps[iSlot] < llOldestMs))
+            return false;
+        values[i] = pPage->values[iSlot];
+        }
+    unit.setValues(values);
+    return true;
+}
+
+//changed entries since the last call, in no particular order
+QVector<ProcessValue> ProcessImage::takeDirty()
+{
+    QVector<ProcessValue> listChanged;
+    QWriteLocker lock(&m_lock);
+    for (auto it = m_hashPages.begin(); it != m_hashPages.end(); ++it) {
+        Page *pPage = it.value().data();
+        if (pPage->dirty.none())
+            continue;
+        for (int iSlot = 0; iSlot < kPageSize; iSlot++) {
+            if (!pPage->dirty[iSlot])
+                continue;
+            ProcessValue pv;
+            pv.slave = static_cast<quint8>(it.key() >> 16);
+            pv.type = static_cast<QModbusDataUnit::RegisterType>((it.key() >> 8) & 0xFF);
+            pv.address = static_cast<quint16>(((it.key() & 0xFF) << kPageBits) | iSlot);
+            pv.value = pPage->values[iSlot];
+            pv.llStampMs = pPage->stamps[iSlot];
+            listChanged.append(pv);
+            }
+        pPage->dirty.reset();
+        }
+    return listChanged;
+}
+
+int ProcessImage::pages() const
+{
+    QReadLocker lock(&m_lock);
+    return m_hashPages.size();
+}
+
+void ProcessImage::clear()
+{
+    QWriteLocker lock(&m_lock);
+    m_hashPages.clear();
+}
@@ -0,0 +1,76 @@
+/****************************************************************************
+**
+** ProcessImage
+**
+**  Last known value of every coil, discrete input, input and holding
+**  register seen on the bus, per slave. The 64K address space of each
+**  table is split into 256-entry pages allocated on first touch, so a
+**  few scattered status registers cost a few pages. Every entry keeps
+**  the time of its last update; changed entries are flagged dirty until
+**  takeDirty() collects them. Updated from every good reply on the Modbus
+**  thread, readable from any thread.
+**
+****************************************************************************/
+
+#ifndef PROCESSIMAGE_H
+#define PROCESSIMAGE_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QModbusDataUnit>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QVector>
+#include <bitset>
+
+struct ProcessValue
+{
+    quint8  slave = 0;
+    QModbusDataUnit::RegisterType type = QModbusDataUnit::Invalid;
+    quint16 address = 0;
+    quint16 value = 0;
+    qint64  llStampMs = 0;  //ProcessImage::now() of the last update
+};
+Q_DECLARE_TYPEINFO(ProcessValue, Q_MOVABLE_TYPE);
+
+class ProcessImage
+{
+public:
+    ProcessImage();
+
+    //monotonic ms, the clock of every stamp
+    qint64 now() const { return m_clock.elapsed(); }
+
+    void update(int slave, const QModbusDataUnit &unit);
+    bool value(int slave, QModbusDataUnit::RegisterType type, int address,
+               quint16 &value, qint64 *pllStampMs = nullptr) const;
+    //fills unit's values when every address is known and at most llMaxAgeMs old, < 0 = any age
+    bool read(int slave, QModbusDataUnit &unit, qint64 llMaxAgeMs = -1) const;
+    QVector<ProcessValue> takeDirty();
+    int pages() const;
+    void clear();
+
+private:
+    static const int kPageBits = 8;
+    static const int kPageSize = 1 << kPageBits;
+
+    struct Page {
+        quint16 values[kPageSize];
+        qint64  stamps[kPageSize];
+        std::bitset<kPageSize> valid;
+        std::bitset<kPageSize> dirty;
+    };
+
+    //slave | type | page, one key per page
+    static quint32 pageKey(int slave, int type, int address)
+    {
+        return (static_cast<quint32>(slave & 0xFF) << 16) | (static_cast<quint32>(type & 0xFF) << 8)
+                | static_cast<quint32>((address & 0xFFFF) >> kPageBits);
+    }
+
+    mutable QReadWriteLock m_lock;
+    QElapsedTimer m_clock;
+    QHash<quint32, QSharedPointer<Page>> m_hashPages;
+};
+
+#endif // PROCESSIMAGE_H
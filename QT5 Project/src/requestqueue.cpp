@@ -0,0 +1,165 @@
+/****************************************************************************
+**
+** RequestQueue
+**
+**    submit -> class list, sorted by deadline (none = last), FIFO on ties
+**    reply in / submit -> while window has room: first entry of the most
+**                         urgent non-empty class -> expired ? drop : send
+**  A reply only frees its slot; the next send is posted, so the finished
+**  handlers of the reply get to submit their follow-up first and it
+**  competes with everything else that is waiting.
+**
+****************************************************************************/
+
+#include "requestqueue.h"
+#include "modbusstats.h"
+
+#include <QModbusClient>
+#include <QModbusReply>
+
+RequestQueue::RequestQueue(QObject *parent)
+    : QObject(parent)
+{
+    m_clock.start();
+}
+
+//requests still queued go to the new device, sent ones finish on the old one
+void RequestQueue::setDevice(QModbusClient *device)
+{
+    modbusDevice = device;
+    m_setInFlight.clear();
+}
+
+void RequestQueue::setWindow(int iWindow)
+{
+    m_iWindow = qMax(1, iWindow);
+    postPump();
+}
+
+void RequestQueue::submit(QObject *pOwner, Priority priority, const ModbusOp &op, int iServerAddr,
+                          const SentFunction &onSent, int iDeadlineMs)
+{
+    Entry entry;
+    entry.pOwner = pOwner;
+    entry.op = op;
+    entry.iServerAddr = iServerAddr;
+    entry.llQueuedNs = m_clock.nsecsElapsed();
+    entry.llDeadlineNs = (iDeadlineMs > 0) ? entry.llQueuedNs + iDeadlineMs*1000000LL : 0;
+    entry.onSent = onSent;
+
+    //behind every entry due no later, entries without a deadline stay FIFO at the end
+    QList<Entry> &list = m_listQueues[qBound(0, static_cast<int>(priority), ePriorityCount - 1)];
+    int i = list.size();
+    if (entry.llDeadlineNs) {
+        while ((i > 0) && (!list.at(i - 1).llDeadlineNs || (list.at(i - 1).llDeadlineNs > entry.llDeadlineNs)))
+            i--;
+        }
+    list.insert(i, entry);
+    pump();
+}
+
+void RequestQueue::cancel(QObject *pOwner)
+{
+    for (QList<Entry> &list : m_listQueues) {
+        for (int i = list.size() - 1; i >= 0; i--)
+            if (list.at(i).pOwner == pOwner)
+                list.removeAt(i);
+        }
+}
+
+int RequestQueue::queued() const
+{
+    int iQueued = 0;
+    for (const QList<Entry> &list : m_listQueues)
+        iQueued += list.size();
+    return iQueued;
+}
+
+void RequestQueue::pump()
+{
+    //onSent may submit again, the running loop picks that up
+    if (m_bPumping)
+        return;
+    m_bPumping = true;
+    while (m_setInFlight.size() < m_iWindow) {
+        int iClass = 0;
+        while ((iClass < ePriorityCount) && m_listQueues[iClass].isEmpty())
+            iClass++;
+        if (iClass == ePriorityCount)
+            break;
+
+        const Entry entry = m_listQueues[iClass].takeFirst();
+        if (!entry.pOwner)
+            continue;
+        const qint64 llWaitNs = m_clock.nsecsElapsed() - entry.llQueuedNs;
+        const bool bLate = entry.llDeadlineNs && (entry.llQueuedNs + llWaitNs > entry.llDeadlineNs);
+        if (bLate && (iClass >= ePoll)) {
+            if (m_pStats)
+                m_pStats->queueDropped(iClass);
+            entry.onSent(nullptr, true);
+            continue;
+            }
+
+        const int fc = entry.op.fc;
+        QModbusReply *reply = nullptr;
+        if (modbusDevice) {
+            if (m_pStats)
+                m_pStats->applyTimeout(modbusDevice, fc, entry.iServerAddr);
+            reply = ModbusScript::send(modbusDevice, entry.op, entry.iServerAddr);
+            }
+        if (m_pStats) {
+            if (reply) {
+                m_pStats->requestSent(reply->isFinished() ? nullptr : reply, fc, entry.iServerAddr, m_pStats->now() - llWaitNs);
+                m_pStats->queueWait(iClass, llWaitNs, bLate);
+                }
+            else {
+                m_pStats->sendFailed();
+                }
+            }
+        //connected ahead of the owner, the slot is free before its handler runs
+        if (reply && !reply->isFinished()) {
+            m_setInFlight.insert(reply);
+            connect(reply, &QModbusReply::finished, this, &RequestQueue::onReplyFinished);
+            }
+        entry.onSent(reply, false);
+        }
+    m_bPumping = false;
+}
+
+void RequestQueue::postPump()
+{
+    if (m_bPumpPosted)
+        return;
+    m_bPumpPosted = true;
+    QMetaObject::invokeMethod(this, [this]() {
+        m_bPumpPosted = false;
+        pump();
+        }, Qt::QueuedConnection);
+}
+
+void RequestQueue::onReplyFinished()
+{
+    auto reply = qobject_cast<QModbusReply *>(sender());
+    if (!reply) return;
+    disconnect(reply, nullptr, this, nullptr);
+    if (m_setInFlight.remove(reply))
+        postPump();
+}
+
+RequestQueue::Priority RequestQueue::priorityOf(const ModbusOp &op, Priority defaultPriority)
+{
+    if ((op.priority >= 0) && (op.priority < ePriorityCount))
+        return static_cast<Priority>(op.priority);
+    return defaultPriority;
+}
+
+const char *RequestQueue::name(int priority)
+{
+    switch (priority) {
+        case eEmergency:  return "emergency";
+        case eAction:     return "action";
+        case ePoll:       return "poll";
+        case eBackground: return "background";
+        default:          return "?";
+        }
+}
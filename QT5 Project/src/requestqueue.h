@@ -0,0 +1,88 @@
+/****************************************************************************
+**
+** RequestQueue
+**
+**  The one way onto the client. Requests wait here in four classes,
+**  emergency, action, poll and background, and go out only while the
+**  client has fewer than window requests of ours on the bus, so a new
+**  request never sits behind a backlog inside the client. Each time a
+**  reply is in the next one comes from the most urgent class that has
+**  any, earliest deadline first within it: a STOP waits for at most the
+**  frame on the wire. Poll and background requests still waiting at
+**  their deadline are dropped, the other classes only count it. Queue
+**  wait goes to ModbusStats per class.
+**
+****************************************************************************/
+
+#ifndef REQUESTQUEUE_H
+#define REQUESTQUEUE_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <functional>
+
+#include "modbusscript.h"
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+QT_END_NAMESPACE
+
+class ModbusStats;
+
+class RequestQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority { eEmergency, eAction, ePoll, eBackground, ePriorityCount };
+
+    //reply is null when nothing went out: bExpired = dropped at its deadline, else a send error
+    typedef std::function<void(QModbusReply *reply, bool bExpired)> SentFunction;
+
+    explicit RequestQueue(QObject *parent = nullptr);
+
+    void setDevice(QModbusClient *device);
+    void setStats(ModbusStats *pStats) { m_pStats = pStats; }
+    //requests on the client at once, 1 = every frame boundary is a preemption point
+    void setWindow(int iWindow);
+
+    //onSent runs on this thread, possibly before submit() returns. iDeadlineMs from now, 0 = none
+    void submit(QObject *pOwner, Priority priority, const ModbusOp &op, int iServerAddr,
+                const SentFunction &onSent, int iDeadlineMs = 0);
+    //forget the queued requests of pOwner, sent ones finish on the client
+    void cancel(QObject *pOwner);
+    int queued() const;
+    int inFlight() const { return m_setInFlight.size(); }
+
+    static Priority priorityOf(const ModbusOp &op, Priority defaultPriority);
+    static const char *name(int priority);
+
+private:
+    struct Entry {
+        QPointer<QObject> pOwner;
+        ModbusOp op;
+        int iServerAddr = 1;
+        qint64 llQueuedNs = 0;
+        qint64 llDeadlineNs = 0;    //0 = none
+        SentFunction onSent;
+    };
+
+    void pump();
+    void postPump();
+    void onReplyFinished();
+
+    QModbusClient *modbusDevice = nullptr;
+    ModbusStats *m_pStats = nullptr;
+    QList<Entry> m_listQueues[ePriorityCount];
+    QElapsedTimer m_clock;
+    int m_iWindow = 1;
+    QSet<QModbusReply *> m_setInFlight;
+    bool m_bPumping = false;
+    bool m_bPumpPosted = false;
+};
+
+#endif // REQUESTQUEUE_H
@@ -0,0 +1,421 @@
+#include "rtudirectmaster.h"
+#include "modbusstats.h"
+#include "crc16.h"
+#include "serialtty.h"
+
+#include <QtSerialBus/private/qmodbusclient_p.h>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+#include <QDebug>
+#include <atomic>
+
+#include <errno.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static const int kMaxAdu = 256;
+static const int kTurnaroundMs = 100;   //after a broadcast, before the next frame
+
+//ADU length of a reply from its first bytes, 0 = unknown yet or variable
+static int expectedLength(const char *frame, int iSize)
+{
+    if (iSize < 2)
+        return 0;
+    const quint8 fc = static_cast<quint8>(frame[1]);
+    if (fc & 0x80)
+        return 5;                   //slave, fc, exception code, crc
+    switch (fc) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x17:
+            return (iSize < 3) ? 0 : 5 + static_cast<quint8>(frame[2]);
+        case 0x05: case 0x06: case 0x0F: case 0x10:
+            return 8;
+        default:
+            return 0;               //left to the t3.5 idle timer
+        }
+}
+
+/*** RtuLink: the tty, its epoll set and the request queue ***/
+
+class RtuLink : public QThread
+{
+public:
+    enum Result { eReply, eBroadcast, eTimeout, eIoError, eClosed };
+
+    struct Job {
+        quint32 uId = 0;
+        QByteArray adu;
+        int iTimeoutMs = 1000;
+        int iTries = 1;
+        bool bBroadcast = false;
+    };
+
+    explicit RtuLink(RtuDirectMaster *pMaster) : m_pMaster(pMaster) {}
+    ~RtuLink() { close(); }
+
+    bool open(const QString &sPort, int baud, int parity, int dataBits, int stopBits, QString &sError);
+    void close();
+    void post(const Job &job);
+    void setStats(ModbusStats *pStats) { m_pStats = pStats; }
+
+protected:
+    void run() override;
+
+private:
+    int transact(const Job &job, QByteArray &pdu);
+    int receive(const Job &job, qint64 llDeadlineNs, QByteArray &pdu);
+    bool sendFrame(const QByteArray &adu);
+    void closeFds();
+
+    RtuDirectMaster *m_pMaster;
+    std::atomic<ModbusStats *> m_pStats{nullptr};
+    int m_fd = -1;
+    int m_epfd = -1;
+    int m_timerfd = -1;
+    int m_wakefd = -1;
+    qint64 m_llT35Ns = 0;
+    qint64 m_llIdleNs = 0;      //monotonic end of the last bus activity
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QQueue<Job> m_queueJobs;    //guarded by m_mutex
+    bool m_bStop = false;       //guarded by m_mutex
+};
+
+bool RtuLink::open(const QString &sPort, int baud, int parity, int dataBits, int stopBits, QString &sError)
+{
+    m_fd = openSerialTty(sPort, baud, parity, dataBits, stopBits, sError);
+    if (m_fd < 0)
+        return false;
+
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((m_epfd < 0) || (m_timerfd < 0) || (m_wakefd < 0)) {
+        sError = QString::fromLocal8Bit(strerror(errno));
+        closeFds();
+        return false;
+        }
+    for (int fd : {m_fd, m_timerfd, m_wakefd}) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+    m_llT35Ns = serialFrameGapNs(baud, parity, dataBits, stopBits);
+    m_llIdleNs = monotonicNs();
+
+    m_bStop = false;
+    start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void RtuLink::close()
+{
+    if (isRunning()) {
+        {
+            QMutexLocker lock(&m_mutex);
+            m_bStop = true;
+            m_wake.wakeOne();
+        }
+        const quint64 one = 1;
+        if (::write(m_wakefd, &one, sizeof(one)) < 0)   //aborts a receive in progress
+            qWarning() << "RtuLink wake failed:" << strerror(errno);
+        wait();
+        }
+    m_queueJobs.clear();
+    closeFds();
+}
+
+void RtuLink::closeFds()
+{
+    for (int *pFd : {&m_fd, &m_epfd, &m_timerfd, &m_wakefd}) {
+        if (*pFd >= 0)
+            ::close(*pFd);
+        *pFd = -1;
+        }
+}
+
+void RtuLink::post(const Job &job)
+{
+    QMutexLocker lock(&m_mutex);
+    m_queueJobs.enqueue(job);
+    m_wake.wakeOne();
+}
+
+//link thread: one transaction at a time, results go back queued to the client's thread
+void RtuLink::run()
+{
+    QMutexLocker lock(&m_mutex);
+    forever {
+        while (!m_bStop && m_queueJobs.isEmpty())
+            m_wake.wait(&m_mutex);
+        if (m_bStop)
+            return;
+        const Job job = m_queueJobs.dequeue();
+        lock.unlock();
+
+        QByteArray pdu;
+        const int result = transact(job, pdu);
+        if (result == eClosed)
+            return;
+        RtuDirectMaster *pMaster = m_pMaster;
+        const quint32 uId = job.uId;
+        QMetaObject::invokeMethod(pMaster, [pMaster, uId, result, pdu]() {
+            pMaster->finish(uId, result, pdu);
+            }, Qt::QueuedConnection);
+        lock.relock();
+        }
+}
+
+int RtuLink::transact(const Job &job, QByteArray &pdu)
+{
+    int result = eTimeout;
+    for (int iTry = 0; iTry < job.iTries; iTry++) {
+        ModbusStats *pStats = m_pStats;
+        if ((iTry > 0) && pStats)
+            pStats->retried();
+
+        //frames are separated by at least t3.5 of silence
+        sleepUntilNs(m_llIdleNs + m_llT35Ns);
+        tcflush(m_fd, TCIFLUSH);    //late bytes of an earlier, timed out reply
+        if (!sendFrame(job.adu))
+            return eIoError;
+        m_llIdleNs = monotonicNs();
+        if (job.bBroadcast) {
+            m_llIdleNs += static_cast<qint64>(kTurnaroundMs)*1000000;
+            return eBroadcast;
+            }
+
+        result = receive(job, m_llIdleNs + static_cast<qint64>(job.iTimeoutMs)*1000000, pdu);
+        if (result != eTimeout)
+            return result;
+        }
+    return result;
+}
+
+//returns once the last bit has left the UART
+bool RtuLink::sendFrame(const QByteArray &adu)
+{
+    const char *p = adu.constData();
+    int iLeft = adu.size();
+    while (iLeft > 0) {
+        const ssize_t n = ::write(m_fd, p, iLeft);
+        if (n > 0) {
+            p += n;
+            iLeft -= n;
+            }
+        else if ((n < 0) && (errno == EAGAIN))
+            tcdrain(m_fd);
+        else if (!((n < 0) && (errno == EINTR)))
+            return false;
+        }
+    return tcdrain(m_fd) == 0;
+}
+
+int RtuLink::receive(const Job &job, qint64 llDeadlineNs, QByteArray &pdu)
+{
+    char frame[kMaxAdu];
+    int iSize = 0;
+    int iExpected = 0;      //0 until the header tells
+    qint64 llLastNs = 0;    //arrival of the last byte
+    forever {
+        if (iExpected && (iSize >= iExpected)) {
+            iSize = iExpected;
+            break;          //complete on its last byte, no need to wait t3.5
+            }
+        const qint64 llUntilNs = (iSize == 0) ? llDeadlineNs : llLastNs + m_llT35Ns;
+        if (monotonicNs() >= llUntilNs) {
+            if (iSize == 0)
+                return eTimeout;
+            break;          //line idle for t3.5: end of frame
+            }
+        armTimerNs(m_timerfd, llUntilNs);
+
+        epoll_event events[3];
+        const int n = epoll_wait(m_epfd, events, 3, -1);
+        if ((n < 0) && (errno != EINTR))
+            return eIoError;
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == m_wakefd)
+                return eClosed;
+            if (fd == m_timerfd) {
+                quint64 expirations;
+                if (::read(m_timerfd, &expirations, sizeof(expirations)) < 0) {}
+                continue;
+                }
+            ssize_t r = 0;
+            while ((iSize < kMaxAdu) && ((r = ::read(m_fd, frame + iSize, kMaxAdu - iSize)) > 0)) {
+                iSize += r;
+                llLastNs = monotonicNs();
+                }
+            if (iSize == kMaxAdu)
+                tcflush(m_fd, TCIFLUSH);    //longer than any ADU, the CRC will reject it
+            else if ((r < 0) && (errno != EAGAIN) && (errno != EINTR))
+                return eIoError;
+            if (!iExpected)
+                iExpected = expectedLength(frame, iSize);
+            }
+        }
+    m_llIdleNs = llLastNs;
+
+    const quint16 crc = (iSize < 4) ? 0
+            : static_cast<quint16>(static_cast<quint8>(frame[iSize - 2]) | (static_cast<quint8>(frame[iSize - 1]) << 8));
+    if ((iSize < 4) || (Crc16::modbus(frame, iSize - 2) != crc)) {
+        ModbusStats *pStats = m_pStats;
+        if (pStats)
+            pStats->crcError();
+        return eTimeout;    //a garbled reply is no reply, the next try repeats the request
+        }
+    if ((frame[0] != job.adu.at(0)) || ((static_cast<quint8>(frame[1]) & 0x7F) != static_cast<quint8>(job.adu.at(1))))
+        return eTimeout;    //not the answer to this request
+    pdu = QByteArray(frame + 1, iSize - 3);
+    return eReply;
+}
+
+/*** RtuDirectMaster ***/
+
+class RtuDirectMasterPrivate : public QModbusClientPrivate
+{
+    Q_DECLARE_PUBLIC(RtuDirectMaster)
+
+public:
+    QModbusReply *enqueueRequest(const QModbusRequest &request, int serverAddress,
+                                 const QModbusDataUnit &unit, QModbusReply::ReplyType type) override
+    {
+        return q_func()->enqueue(request, serverAddress, unit, type);
+    }
+
+    bool isOpen() const override
+    {
+        return q_func()->state() == QModbusDevice::ConnectedState;
+    }
+};
+
+RtuDirectMaster::RtuDirectMaster(QObject *parent)
+    : QModbusClient(*new RtuDirectMasterPrivate, parent)
+    , m_pLink(new RtuLink(this))
+{
+}
+
+RtuDirectMaster::~RtuDirectMaster()
+{
+    close();
+    delete m_pLink;
+}
+
+void RtuDirectMaster::setStats(ModbusStats *pStats)
+{
+    m_pLink->setStats(pStats);
+}
+
+bool RtuDirectMaster::open()
+{
+    if (state() == QModbusDevice::ConnectedState)
+        return true;
+
+    const QString sPort = connectionParameter(SerialPortNameParameter).toString();
+    QString sError;
+    if (!m_pLink->open(sPort,
+                       connectionParameter(SerialBaudRateParameter).toInt(),
+                       connectionParameter(SerialParityParameter).toInt(),
+                       connectionParameter(SerialDataBitsParameter).toInt(),
+                       connectionParameter(SerialStopBitsParameter).toInt(), sError)) {
+        setError(tr("Could not open %1: %2").arg(sPort, sError), QModbusDevice::ConnectionError);
+        return false;
+        }
+    setState(QModbusDevice::ConnectedState);
+    return true;
+}
+
+void RtuDirectMaster::close()
+{
+    if (state() == QModbusDevice::UnconnectedState)
+        return;
+
+    m_pLink->close();
+    //finishing a reply may queue the next request, so abort a copy
+    const QHash<quint32, Pending> hashAborted = m_hashPending;
+    m_hashPending.clear();
+    for (const Pending &pending : hashAborted) {
+        if (pending.reply)
+            pending.reply->setError(QModbusDevice::ReplyAbortedError, tr("Reply aborted due to connection closure."));
+        }
+    setState(QModbusDevice::UnconnectedState);
+}
+
+QModbusReply *RtuDirectMaster::enqueue(const QModbusRequest &request, int serverAddress,
+                                       const QModbusDataUnit &unit, QModbusReply::ReplyType type)
+{
+    const bool bBroadcast = (serverAddress == 0);
+    auto reply = new QModbusReply(bBroadcast ? QModbusReply::Broadcast : type, serverAddress, this);
+
+    RtuLink::Job job;
+    job.uId = ++m_uNextId;
+    job.adu.reserve(request.size() + 3);
+    job.adu.append(static_cast<char>(serverAddress));
+    job.adu.append(static_cast<char>(request.functionCode()));
+    job.adu.append(request.data());
+    const quint16 crc = Crc16::modbus(job.adu.constData(), job.adu.size());
+    job.adu.append(static_cast<char>(crc & 0xFF));
+    job.adu.append(static_cast<char>(crc >> 8));
+    job.iTimeoutMs = timeout();
+    job.iTries = bBroadcast ? 1 : 1 + qMax(0, numberOfRetries());
+    job.bBroadcast = bBroadcast;
+
+    Pending pending;
+    pending.reply = reply;
+    pending.unit = unit;
+    m_hashPending.insert(job.uId, pending);
+    m_pLink->post(job);
+    return reply;
+}
+
+void RtuDirectMaster::finish(quint32 uId, int result, const QByteArray &pdu)
+{
+    const Pending pending = m_hashPending.take(uId);
+    QModbusReply *reply = pending.reply;
+    if (!reply)
+        return;     //aborted by close() or deleted by its owner
+
+    switch (result) {
+        case RtuLink::eReply: {
+            const QModbusResponse response(static_cast<QModbusPdu::FunctionCode>(static_cast<quint8>(pdu.at(0))), pdu.mid(1));
+            reply->setRawResult(response);
+            if (response.isException()) {
+                reply->setError(QModbusDevice::ProtocolError, tr("Modbus Exception Response."));
+                break;
+                }
+            if (reply->type() != QModbusReply::Common) {
+                reply->setFinished(true);
+                break;
+                }
+            QModbusDataUnit unit = pending.unit;
+            if (!processResponse(response, &unit)) {
+                reply->setError(QModbusDevice::UnknownError, tr("An invalid response has been received."));
+                break;
+                }
+            reply->setResult(unit);
+            reply->setFinished(true);
+            break;
+            }
+        case RtuLink::eBroadcast:
+            reply->setFinished(true);
+            break;
+        case RtuLink::eTimeout:
+            reply->setError(QModbusDevice::TimeoutError, tr("Request timeout."));
+            break;
+        default:
+            reply->setError(QModbusDevice::ReadError, tr("Serial port I/O error."));
+            setError(tr("Serial port I/O error."), QModbusDevice::ReadError);
+            break;
+        }
+}
@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** RtuDirectMaster
+**
+**  Modbus RTU client that drives the tty itself instead of going through
+**  QSerialPort: raw termios with ASYNC_LOW_LATENCY, and an epoll loop on
+**  its own thread (RtuLink) that frames replies on the monotonic clock.
+**  A reply whose length the header tells is complete on its last byte,
+**  anything else once the line has been idle t3.5, measured with a
+**  timerfd instead of epoll's millisecond timeout. Requests queue FIFO
+**  and are finished on the client's thread the way QModbusRtuSerialMaster
+**  does it, so the executor, the scheduler and the stats see no
+**  difference. Built on the QtSerialBus private API, Linux only.
+**
+****************************************************************************/
+
+#ifndef RTUDIRECTMASTER_H
+#define RTUDIRECTMASTER_H
+
+#include <QModbusClient>
+#include <QModbusReply>
+#include <QHash>
+#include <QPointer>
+
+class ModbusStats;
+class RtuLink;
+class RtuDirectMasterPrivate;
+
+class RtuDirectMaster : public QModbusClient
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(RtuDirectMaster)
+
+public:
+    explicit RtuDirectMaster(QObject *parent = nullptr);
+    ~RtuDirectMaster();
+
+    //CRC errors and transport retries are counted here, thread safe
+    void setStats(ModbusStats *pStats);
+
+protected:
+    bool open() override;
+    void close() override;
+
+private:
+    friend class RtuLink;
+
+    QModbusReply *enqueue(const QModbusRequest &request, int serverAddress,
+                          const QModbusDataUnit &unit, QModbusReply::ReplyType type);
+    void finish(quint32 uId, int result, const QByteArray &pdu);
+
+    struct Pending {
+        QPointer<QModbusReply> reply;
+        QModbusDataUnit unit;
+    };
+
+    RtuLink *m_pLink;
+    QHash<quint32, Pending> m_hashPending;
+    quint32 m_uNextId = 0;
+};
+
+#endif // RTUDIRECTMASTER_H
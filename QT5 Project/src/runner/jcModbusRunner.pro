@@ -0,0 +1,17 @@
+QT = core serialbus serialport
+
+TARGET = ../../jcModbusRunner
+TEMPLATE = app
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+#Output
+MOC_DIR     = moc
+OBJECTS_DIR = obj
+
+SOURCES += main.cpp \
+        modbusfleet.cpp
+
+HEADERS += modbusfleet.h
+
+include(../modbuscore.pri)
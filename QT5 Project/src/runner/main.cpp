@@ -0,0 +1,396 @@
+/****************************************************************************
+**
+** jcModbusRunner
+**
+**  Headless CSV script runner (QCoreApplication, no widgets):
+**    jcModbusRunner [-s /dev/ttyS0 | -t 192.168.0.12:502] [-n loops] script.csv
+**
+**  Prints every row and reply, then a timing summary per row and loop.
+**  Scripts with Period(ms) rows run on the PollScheduler for --schedule
+**  seconds and add the achieved rate per slave.
+**  --hosts runs the script on every Modbus TCP device of a hosts file at
+**  once and reports aggregate throughput and latency per device.
+**  --log records every good reply to a binary data log, --export-log
+**  turns one into CSV on stdout. --direct drives the serial port with
+**  RtuDirectMaster instead of QModbusRtuSerialMaster. --sniff only
+**  listens on the -s port and prints every frame until interrupted.
+**  --gateway serves Modbus TCP on a port and forwards it to the -s port.
+**
+****************************************************************************/
+
+#include "modbusscript.h"
+#include "modbussettings.h"
+#include "scriptexecutor.h"
+#include "pollscheduler.h"
+#include "modbusfleet.h"
+#include "modbusstats.h"
+#include "datalogger.h"
+#include "processimage.h"
+#include "modbusgateway.h"
+#ifdef MODBUS_RTU_DIRECT
+#include "bussniffer.h"
+#endif
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QModbusClient>
+#include <QModbusReply>
+#include <QTextStream>
+#include <QHash>
+#include <QMap>
+#include <QTimer>
+
+struct RowStats {
+    int iSent = 0;
+    int iErrors = 0;
+    qint64 llTotalUs = 0;
+    qint64 llMinUs = -1;
+    qint64 llMaxUs = 0;
+};
+
+static int parityFromName(const QString &sParity)
+{
+    if (sParity.startsWith("e", Qt::CaseInsensitive)) return QSerialPort::EvenParity;
+    if (sParity.startsWith("o", Qt::CaseInsensitive)) return QSerialPort::OddParity;
+    if (sParity.startsWith("s", Qt::CaseInsensitive)) return QSerialPort::SpaceParity;
+    if (sParity.startsWith("m", Qt::CaseInsensitive)) return QSerialPort::MarkParity;
+    return QSerialPort::NoParity;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("jcModbusRunner");
+
+    ModbusSettings settings;
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless Modbus CSV script runner");
+    parser.addHelpOption();
+    parser.addPositionalArgument("script", "CSV script to run.");
+    QCommandLineOption optSerial(QStringList() << "s" << "serial", "RTU serial port.", "port", default_serialport);
+    QCommandLineOption optTcp(QStringList() << "t" << "tcp", "Modbus TCP server, host:port.", "host");
+    QCommandLineOption optDirect("direct", "Drive the serial port directly (termios, low latency) on Linux.");
+    QCommandLineOption optSniff("sniff", "Print every frame seen on the serial port, never send (Linux).");
+    QCommandLineOption optGateway("gateway", "Serve Modbus TCP on this port, forwarded to the serial port.", "port");
+    QCommandLineOption optGatewayQueue("gateway-queue", "Requests one gateway client may have waiting.", "count", "16");
+    QCommandLineOption optServer(QStringList() << "a" << "server", "Target server address.", "id", "1");
+    QCommandLineOption optLoops(QStringList() << "n" << "loops", "Number of script loops.", "count", "1");
+    QCommandLineOption optBaud(QStringList() << "b" << "baud", "Baud rate.", "baud", QString::number(settings.baud));
+    QCommandLineOption optParity(QStringList() << "p" << "parity", "none, even, odd, space or mark.", "parity", "none");
+    QCommandLineOption optDataBits("databits", "Data bits.", "bits", QString::number(settings.dataBits));
+    QCommandLineOption optStopBits("stopbits", "Stop bits.", "bits", QString::number(settings.stopBits));
+    QCommandLineOption optTimeout("timeout", "Response timeout in ms.", "ms", QString::number(settings.responseTime));
+    QCommandLineOption optRetries("retries", "Number of retries.", "count", QString::number(settings.numberOfRetries));
+    QCommandLineOption optCoalesce("coalesce-gap", "Merge Rr rows up to this many registers apart, -1 = off.", "regs", QString::number(settings.coalesceGap));
+    QCommandLineOption optWindow(QStringList() << "w" << "window", "Modbus TCP requests kept in flight.", "count", QString::number(settings.tcpWindow));
+    QCommandLineOption optPoll("poll-interval", "Pause between the reads of a Poll row.", "ms", QString::number(settings.pollInterval));
+    QCommandLineOption optCache("cache-age", "Serve Rr/Rc rows from replies at most this old, 0 = off.", "ms", QString::number(settings.cacheMaxAge));
+    QCommandLineOption optHosts("hosts", "Modbus TCP devices, one \"host:port [server] [script.csv]\" per line.", "file");
+    QCommandLineOption optSchedule("schedule", "Seconds to run a script with Period rows.", "s", "10");
+    QCommandLineOption optStats("stats", "Print latency histograms and counters at the end.");
+    QCommandLineOption optAdaptive("adaptive-timeout", "Learn the timeout per slave and function code, --timeout is the upper bound.");
+    QCommandLineOption optLog("log", "Record every good reply to a binary data log.", "file");
+    QCommandLineOption optExportLog("export-log", "Print a data log as CSV and exit.", "file");
+    QCommandLineOption optDryRun(QStringList() << "d" << "dry-run", "Walk the script without sending.");
+    QCommandLineOption optQuiet(QStringList() << "q" << "quiet", "Only print the summary.");
+    QCommandLineOption optVerbose(QStringList() << "v" << "verbose", "Keep qDebug and qt.modbus logging.");
+    parser.addOptions({optSerial, optTcp, optDirect, optSniff, optGateway, optGatewayQueue, optHosts, optServer, optLoops, optBaud, optParity, optDataBits, optStopBits,
+                       optTimeout, optRetries, optCoalesce, optWindow, optPoll, optCache, optSchedule, optStats,
+                       optAdaptive, optLog, optExportLog, optDryRun, optQuiet, optVerbose});
+    parser.process(a);
+
+    if (parser.isSet(optExportLog)) {
+        QTextStream out(stdout);
+        QString sError;
+        if (DataLogger::exportCSV(parser.value(optExportLog), out, sError))
+            return 0;
+        QTextStream(stderr) << sError << endl;
+        return 1;
+        }
+    if (!parser.isSet(optVerbose))
+        QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false"));
+    else
+        QLoggingCategory::setFilterRules(QStringLiteral("qt.modbus* = true"));
+
+    settings.parity = parityFromName(parser.value(optParity));
+    settings.baud = parser.value(optBaud).toInt();
+    settings.dataBits = parser.value(optDataBits).toInt();
+    settings.stopBits = parser.value(optStopBits).toInt();
+    settings.responseTime = parser.value(optTimeout).toInt();
+    settings.numberOfRetries = parser.value(optRetries).toInt();
+    settings.coalesceGap = parser.value(optCoalesce).toInt();
+    settings.tcpWindow = parser.value(optWindow).toInt();
+    settings.pollInterval = parser.value(optPoll).toInt();
+    settings.cacheMaxAge = parser.value(optCache).toInt();
+    settings.adaptiveTimeout = parser.isSet(optAdaptive);
+    const int iServerAddr = parser.value(optServer).toInt();
+    const int iLoops = parser.value(optLoops).toInt();
+    const bool bDryRun = parser.isSet(optDryRun);
+    const bool bQuiet = parser.isSet(optQuiet);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    if (parser.isSet(optSniff)) {
+#ifdef MODBUS_RTU_DIRECT
+        BusSniffer sniffer;
+        QString sError;
+        if (!sniffer.open(parser.value(optSerial), settings, sError)) {
+            err << "Sniff " << parser.value(optSerial) << ": " << sError << endl;
+            return 1;
+            }
+        QObject::connect(&sniffer, &BusSniffer::framesPending, &a, [&]() {
+            sniffer.clearPending();
+            QString sLine;
+            BusSniffer::Kind kind;
+            while (sniffer.nextLine(sLine, kind))
+                out << sLine << "\n";
+            const qint64 llDropped = sniffer.takeDropped();
+            if (llDropped)
+                out << "!!! " << llDropped << " bytes/frames dropped\n";
+            out.flush();
+            }, Qt::QueuedConnection);
+        return a.exec();
+#else
+        err << "--sniff needs Linux" << endl;
+        return 1;
+#endif
+        }
+    if (parser.isSet(optGateway)) {
+        ModbusStats gatewayStats;
+        gatewayStats.setAdaptiveTimeout(settings.adaptiveTimeout ? settings.responseTime : 0);
+        ProcessImage gatewayImage;
+        QModbusClient *modbusDevice = createModbusClient(parser.isSet(optDirect) ? eTransportRtuDirect : eTransportRtu, &gatewayStats, &a);
+        applyModbusSettings(modbusDevice, parser.value(optSerial), settings);
+        ModbusGateway gateway;
+        gateway.setDevice(modbusDevice);
+        gateway.setCache(&gatewayImage, settings.cacheMaxAge);
+        gateway.setStats(&gatewayStats);
+        gateway.setQueueLimit(parser.value(optGatewayQueue).toInt());
+        if (!bQuiet)
+            QObject::connect(&gateway, &ModbusGateway::message, [&](const QString &sMsg) { out << sMsg << endl; });
+        if (!modbusDevice->connectDevice()) {
+            err << "Gateway " << parser.value(optSerial) << ": " << modbusDevice->errorString() << endl;
+            return 1;
+            }
+        QString sError;
+        if (!gateway.listen(parser.value(optGateway).toUShort(), sError)) {
+            err << "Gateway port " << parser.value(optGateway) << ": " << sError << endl;
+            return 1;
+            }
+        //no end to print the summary at, so every 10s
+        QTimer timerStats;
+        if (parser.isSet(optStats)) {
+            QObject::connect(&timerStats, &QTimer::timeout, [&]() { out << gatewayStats.report() << flush; });
+            timerStats.start(10000);
+            }
+        return a.exec();
+        }
+    if (parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+
+    const QString sScript = parser.positionalArguments().first();
+    QList<QStringList> listCSV;
+    QStringList listHeader;
+    if (!ModbusScript::loadCSV(sScript, listCSV, listHeader)) {
+        err << "Can't open " << sScript << endl;
+        return 1;
+        }
+
+    const ModbusProgram program = ModbusScript::coalesceWrites(ModbusScript::coalesceReads(ModbusScript::compile(listCSV), settings.coalesceGap));
+    const bool bSchedule = ModbusScript::isScheduled(program);
+    if (parser.isSet(optHosts)) {
+        QVector<FleetDevice> listDevices;
+        QString sError;
+        if (!ModbusFleet::loadHosts(parser.value(optHosts), sScript, iServerAddr, settings.coalesceGap, listDevices, sError)) {
+            err << sError << endl;
+            return 1;
+            }
+        ModbusFleet fleet(settings, iLoops);
+        QObject::connect(&fleet, &ModbusFleet::finished, [&]() {
+            out << fleet.report();
+            a.exit(fleet.errors() ? 1 : 0);
+            });
+        fleet.start(listDevices);
+        return a.exec();
+        }
+
+    QHash<QModbusReply *, qint64> hashSentNs;    //in flight, send time on timerTotal; outlives the executor
+    ScriptExecutor executor;
+    executor.setScript(program);
+    executor.setPollInterval(settings.pollInterval);
+    PollScheduler scheduler;
+    scheduler.setScript(program);
+    ModbusStats modbusStats;
+    modbusStats.setAdaptiveTimeout(settings.adaptiveTimeout ? settings.responseTime : 0);
+    if (parser.isSet(optStats) || settings.adaptiveTimeout) {
+        executor.setStats(&modbusStats);
+        scheduler.setStats(&modbusStats);
+        }
+    ProcessImage image;
+    executor.setCache(&image, settings.cacheMaxAge);
+    DataLogger logger;
+    if (parser.isSet(optLog)) {
+        QString sError;
+        if (!logger.open(parser.value(optLog), sError)) {
+            err << "Data log: " << sError << endl;
+            return 1;
+            }
+        }
+
+    QModbusClient *modbusDevice = nullptr;
+    QString sPort;
+    if (!bDryRun) {
+        if (parser.isSet(optTcp)) {
+            modbusDevice = createModbusClient(eTransportTcp, &modbusStats, &a);
+            sPort = parser.value(optTcp);
+            executor.setWindow(settings.tcpWindow);
+            }
+        else {
+            modbusDevice = createModbusClient(parser.isSet(optDirect) ? eTransportRtuDirect : eTransportRtu, &modbusStats, &a);
+            sPort = parser.value(optSerial);
+            }
+        applyModbusSettings(modbusDevice, sPort, settings);
+        executor.setDevice(modbusDevice);
+        scheduler.setDevice(modbusDevice);
+        }
+
+    //timing
+    QMap<int, RowStats> mapStats;
+    QVector<qint64> listCycleUs;
+    QElapsedTimer timerLoop, timerTotal;
+    int iRequests = 0, iErrors = 0;
+
+    auto onRowStarted = [&](int row) {
+        if (!bQuiet)
+            out << "> " << row << " " << listCSV[row][enumModbusCSV::eCategory] << " "
+                << listCSV[row][enumModbusCSV::eDescription] << endl;
+        };
+    auto onMessage = [&](const QString &sMsg) {
+        if (!bQuiet)
+            out << sMsg << endl;
+        };
+    auto onRequestSent = [&](int, QModbusReply *reply) {
+        iRequests++;
+        hashSentNs.insert(reply, timerTotal.nsecsElapsed());
+        //replies are children of the client and die after the hash, the hook goes with the executor
+        QObject::connect(reply, &QObject::destroyed, &executor, [&hashSentNs, reply]() { hashSentNs.remove(reply); });
+        };
+    auto onReplyReady = [&](int row, QModbusReply *reply, const QModbusDataUnit &unit) {
+        qint64 llUs = (timerTotal.nsecsElapsed() - hashSentNs.value(reply))/1000;
+        RowStats &stats = mapStats[row];
+        stats.iSent++;
+        stats.llTotalUs += llUs;
+        if ((stats.llMinUs < 0) || (llUs < stats.llMinUs)) stats.llMinUs = llUs;
+        if (llUs > stats.llMaxUs) stats.llMaxUs = llUs;
+        if (reply->error() == QModbusDevice::NoError) {
+            image.update(reply->serverAddress(), unit);
+            logger.record(reply->serverAddress(), unit);
+            if (!bQuiet)
+                out << ModbusScript::formatUnit(unit) << "  " << llUs/1000.0 << "ms" << endl;
+            }
+        else {
+            stats.iErrors++;
+            iErrors++;
+            if (reply->error() == QModbusDevice::ProtocolError)
+                out << "!!! " << reply->errorString() << ": " << QString::number(reply->rawResult().exceptionCode(), 16) << endl;
+            else
+                out << "Err " << reply->errorString() << ": " << QString::number(reply->error(), 16) << endl;
+            }
+        };
+    QObject::connect(&executor, &ScriptExecutor::rowStarted, onRowStarted);
+    QObject::connect(&executor, &ScriptExecutor::message, onMessage);
+    QObject::connect(&executor, &ScriptExecutor::requestSent, onRequestSent);
+    QObject::connect(&executor, &ScriptExecutor::replyReady, onReplyReady);
+    QObject::connect(&executor, &ScriptExecutor::cachedReady, [&](int, const QModbusDataUnit &unit) {
+        if (!bQuiet)
+            out << ModbusScript::formatUnit(unit) << "  cached" << endl;
+        });
+    QObject::connect(&scheduler, &PollScheduler::rowStarted, onRowStarted);
+    QObject::connect(&scheduler, &PollScheduler::message, onMessage);
+    QObject::connect(&scheduler, &PollScheduler::requestSent, onRequestSent);
+    QObject::connect(&scheduler, &PollScheduler::replyReady, onReplyReady);
+    QObject::connect(&executor, &ScriptExecutor::loopStarted, [&](int iLoop) {
+        if (!bQuiet)
+            out << "<" << (bDryRun ? QString(" Dry Run ") : QString()) << iLoop << ">" << endl;
+        timerLoop.start();
+        });
+    QObject::connect(&executor, &ScriptExecutor::loopFinished, [&](int) {
+        listCycleUs.append(timerLoop.nsecsElapsed()/1000);
+        if (!bQuiet)
+            out << "-------------------- " << listCycleUs.last()/1000.0 << "ms" << endl;
+        });
+    auto onFinished = [&]() {
+        double dTotalS = timerTotal.nsecsElapsed()/1e9;
+        out << endl << "=== " << sScript << " (" << listCycleUs.size() << " loops, "
+            << iRequests << " requests, " << iErrors << " errors, " << dTotalS << "s)" << endl;
+        if (dTotalS > 0)
+            out << "requests/s: " << iRequests/dTotalS << endl;
+        if (!listCycleUs.isEmpty()) {
+            qint64 llMin = listCycleUs.first(), llMax = 0, llSum = 0;
+            for (qint64 llUs : listCycleUs) {
+                llMin = qMin(llMin, llUs);
+                llMax = qMax(llMax, llUs);
+                llSum += llUs;
+                }
+            out << "cycle ms  min " << llMin/1000.0 << "  avg " << llSum/1000.0/listCycleUs.size()
+                << "  max " << llMax/1000.0 << endl;
+            }
+        out << "row  description           sent  err   avg ms   min ms   max ms" << endl;
+        for (auto it = mapStats.constBegin(); it != mapStats.constEnd(); ++it) {
+            const RowStats &stats = it.value();
+            out << qSetFieldWidth(4) << left << it.key() << qSetFieldWidth(0) << " "
+                << qSetFieldWidth(20) << listCSV[it.key()][enumModbusCSV::eDescription].left(20) << qSetFieldWidth(0)
+                << right << qSetFieldWidth(6) << stats.iSent << stats.iErrors << qSetFieldWidth(9)
+                << stats.llTotalUs/1000.0/stats.iSent << stats.llMinUs/1000.0 << stats.llMaxUs/1000.0
+                << qSetFieldWidth(0) << left << endl;
+            }
+        if (bSchedule && bQuiet)
+            out << scheduler.report() << endl;
+        if (parser.isSet(optStats))
+            out << modbusStats.report();
+        if (logger.isOpen()) {
+            out << "data log: " << logger.records() << " records" << endl;
+            logger.close();
+            }
+        if (modbusDevice)
+            modbusDevice->disconnectDevice();
+        a.exit(iErrors ? 1 : 0);
+        };
+    QObject::connect(&executor, &ScriptExecutor::finished, onFinished);
+    QObject::connect(&scheduler, &PollScheduler::finished, onFinished);
+
+    //scripts with Period rows poll for a fixed time instead of counting loops
+    auto startRun = [&](bool bDry) {
+        timerTotal.start();
+        if (bSchedule) {
+            scheduler.start(iServerAddr, bDry);
+            QTimer::singleShot(parser.value(optSchedule).toInt()*1000, &scheduler, &PollScheduler::stop);
+            }
+        else {
+            executor.start(iLoops, iServerAddr, bDry);
+            }
+        };
+
+    if (bDryRun) {
+        QTimer::singleShot(0, [&]() { startRun(true); });
+        return a.exec();
+        }
+
+    QObject::connect(modbusDevice, &QModbusClient::stateChanged, [&](QModbusDevice::State state) {
+        if ((state == QModbusDevice::ConnectedState) && !timerTotal.isValid())
+            startRun(false);
+        });
+    QObject::connect(modbusDevice, &QModbusClient::errorOccurred, [&](QModbusDevice::Error) {
+        err << "Modbus error: " << modbusDevice->errorString() << endl;
+        if (!timerTotal.isValid())
+            a.exit(2);
+        });
+    if (!modbusDevice->connectDevice()) {
+        err << "Connect failed: " << modbusDevice->errorString() << endl;
+        return 2;
+        }
+    return a.exec();
+}
@@ -0,0 +1,225 @@
+/****************************************************************************
+**
+** ModbusFleet
+**
+**  Sessions report a SessionStats once when their loops are done (or the
+**  connect failed); the fleet quits its threads when the last one is in.
+**
+****************************************************************************/
+
+#include "modbusfleet.h"
+#include "scriptexecutor.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QModbusReply>
+#include <QModbusTcpClient>
+#include <QTextStream>
+#include <QThread>
+
+DeviceSession::DeviceSession(int iId, const FleetDevice &device, const ModbusSettings &settings, int iLoops)
+    : m_device(device)
+    , m_settings(settings)
+    , m_iLoops(iLoops)
+{
+    m_stats.iId = iId;
+}
+
+//runs on the session thread, the client is created there
+void DeviceSession::start()
+{
+    modbusDevice = new QModbusTcpClient(this);
+    applyModbusSettings(modbusDevice, m_device.sHost, m_settings);
+    m_pScript = new ScriptExecutor(this);
+    m_pScript->setDevice(modbusDevice);
+    m_pScript->setScript(m_device.program);
+    m_pScript->setWindow(m_settings.tcpWindow);
+    m_pScript->setPollInterval(m_settings.pollInterval);
+
+    connect(m_pScript, &ScriptExecutor::requestSent, this, [this](int, QModbusReply *reply) {
+        m_stats.iRequests++;
+        m_hashSentNs.insert(reply, m_clock.nsecsElapsed());
+        connect(reply, &QObject::destroyed, this, [this, reply]() { m_hashSentNs.remove(reply); });
+        });
+    connect(m_pScript, &ScriptExecutor::replyReady, this, [this](int, QModbusReply *reply, const QModbusDataUnit &) {
+        qint64 llUs = (m_clock.nsecsElapsed() - m_hashSentNs.value(reply))/1000;
+        m_stats.llTotalUs += llUs;
+        if ((m_stats.llMinUs < 0) || (llUs < m_stats.llMinUs)) m_stats.llMinUs = llUs;
+        if (llUs > m_stats.llMaxUs) m_stats.llMaxUs = llUs;
+        if (reply->error() != QModbusDevice::NoError)
+            m_stats.iErrors++;
+        });
+    connect(m_pScript, &ScriptExecutor::finished, this, [this]() {
+        finish(QString());
+        });
+    connect(modbusDevice, &QModbusClient::stateChanged, this, [this](QModbusDevice::State state) {
+        if ((state == QModbusDevice::ConnectedState) && !m_stats.bConnected) {
+            m_stats.bConnected = true;
+            m_clock.start();
+            m_pScript->start(m_iLoops, m_device.iServerAddr, false);
+            }
+        });
+    connect(modbusDevice, &QModbusClient::errorOccurred, this, [this](QModbusDevice::Error) {
+        if (!m_stats.bConnected)
+            finish(modbusDevice->errorString());
+        });
+    if (!modbusDevice->connectDevice())
+        finish(modbusDevice->errorString());
+}
+
+void DeviceSession::finish(const QString &sError)
+{
+    if (m_bDone)
+        return;
+    m_bDone = true;
+    m_stats.sError = sError;
+    m_pScript->stop();
+    modbusDevice->disconnectDevice();
+    emit finished(m_stats);
+}
+
+ModbusFleet::ModbusFleet(const ModbusSettings &settings, int iLoops, QObject *parent)
+    : QObject(parent)
+    , m_settings(settings)
+    , m_iLoops(iLoops)
+{
+    qRegisterMetaType<SessionStats>();
+}
+
+ModbusFleet::~ModbusFleet()
+{
+    for (QThread *pThread : m_listThreads) {
+        pThread->quit();
+        pThread->wait();
+        delete pThread;
+        }
+}
+
+bool ModbusFleet::loadHosts(const QString &sFilename, const QString &sDefaultScript, int iDefaultServer,
+                            int iCoalesceGap, QVector<FleetDevice> &listDevices, QString &sError)
+{
+    QFile file(sFilename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        sError = "Can't open " + sFilename;
+        return false;
+        }
+
+    //scripts are compiled once and shared by every device that runs them
+    QHash<QString, ModbusProgram> hashPrograms;
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine().simplified();
+        if (line.isEmpty() || line.startsWith("#") || line.startsWith(";"))
+            continue;
+        QStringList listFields = line.split(' ');
+        FleetDevice device;
+        device.sHost = listFields[0];
+        device.iServerAddr = (listFields.size() > 1) ? listFields[1].toInt() : iDefaultServer;
+        device.sScript = (listFields.size() > 2) ? listFields[2] : sDefaultScript;
+        if (QFileInfo(device.sScript).isRelative() && !QFileInfo::exists(device.sScript))
+            device.sScript = QFileInfo(sFilename).dir().filePath(device.sScript);
+        if (!hashPrograms.contains(device.sScript)) {
+            QList<QStringList> listCSV;
+            QStringList listHeader;
+            if (!ModbusScript::loadCSV(device.sScript, listCSV, listHeader)) {
+                sError = "Can't open " + device.sScript;
+                return false;
+                }
+            hashPrograms.insert(device.sScript, ModbusScript::coalesceWrites(
+                                  ModbusScript::coalesceReads(ModbusScript::compile(listCSV), iCoalesceGap)));
+            }
+        device.program = hashPrograms.value(device.sScript);
+        listDevices.append(device);
+        }
+    if (listDevices.isEmpty()) {
+        sError = "No devices in " + sFilename;
+        return false;
+        }
+    return true;
+}
+
+void ModbusFleet::start(const QVector<FleetDevice> &listDevices)
+{
+    m_listDevices = listDevices;
+    m_listStats.resize(listDevices.size());
+    m_listThreadOf.resize(listDevices.size());
+    const int iThreads = qBound(1, QThread::idealThreadCount(), listDevices.size());
+    for (int t = 0; t < iThreads; t++) {
+        QThread *pThread = new QThread;
+        pThread->setObjectName(QString("fleet%1").arg(t));
+        pThread->start();
+        m_listThreads.append(pThread);
+        m_listLoad.append(0);
+        }
+
+    m_timer.start();
+    for (int i = 0; i < listDevices.size(); i++) {
+        int iThread = 0;
+        for (int t = 1; t < iThreads; t++) {
+            if (m_listLoad.at(t) < m_listLoad.at(iThread))
+                iThread = t;
+            }
+        m_listLoad[iThread]++;
+        m_listThreadOf[i] = iThread;
+
+        DeviceSession *pSession = new DeviceSession(i, listDevices.at(i), m_settings, m_iLoops);
+        pSession->moveToThread(m_listThreads.at(iThread));
+        connect(m_listThreads.at(iThread), &QThread::finished, pSession, &QObject::deleteLater);
+        connect(pSession, &DeviceSession::finished, this, &ModbusFleet::onSessionFinished);
+        QMetaObject::invokeMethod(pSession, "start", Qt::QueuedConnection);
+        }
+}
+
+void ModbusFleet::onSessionFinished(const SessionStats &stats)
+{
+    m_listStats[stats.iId] = stats;
+    m_listLoad[m_listThreadOf.at(stats.iId)]--;
+    if (++m_iDone < m_listDevices.size())
+        return;
+
+    m_llRunNs = m_timer.nsecsElapsed();
+    for (QThread *pThread : m_listThreads)
+        pThread->quit();
+    emit finished();
+}
+
+int ModbusFleet::errors() const
+{
+    int iErrors = 0;
+    for (const SessionStats &stats : m_listStats)
+        iErrors += stats.sError.isEmpty() ? stats.iErrors : 1;
+    return iErrors;
+}
+
+QString ModbusFleet::report() const
+{
+    int iRequests = 0, iErrors = 0;
+    for (const SessionStats &stats : m_listStats) {
+        iRequests += stats.iRequests;
+        iErrors += stats.iErrors;
+        }
+    const double dTotalS = m_llRunNs/1e9;
+
+    QString sReport;
+    QTextStream out(&sReport);
+    out << "=== fleet (" << m_listDevices.size() << " devices on " << m_listThreads.size() << " threads, "
+        << iRequests << " requests, " << iErrors << " errors, " << dTotalS << "s)" << endl;
+    if (dTotalS > 0)
+        out << "requests/s: " << iRequests/dTotalS << endl;
+    out << "dev  host                   thr   sent   err   avg ms   min ms   max ms" << endl;
+    for (int i = 0; i < m_listStats.size(); i++) {
+        const SessionStats &stats = m_listStats.at(i);
+        out << qSetFieldWidth(4) << left << i << qSetFieldWidth(0) << " "
+            << qSetFieldWidth(22) << m_listDevices.at(i).sHost.left(22) << qSetFieldWidth(0)
+            << right << qSetFieldWidth(4) << m_listThreadOf.at(i) << qSetFieldWidth(0);
+        if (!stats.sError.isEmpty()) {
+            out << "  !!! " << stats.sError << endl;
+            continue;
+            }
+        out << qSetFieldWidth(7) << stats.iRequests << qSetFieldWidth(6) << stats.iErrors << qSetFieldWidth(9)
+            << (stats.iRequests ? stats.llTotalUs/1000.0/stats.iRequests : 0.0) << stats.llMinUs/1000.0 << stats.llMaxUs/1000.0
+            << qSetFieldWidth(0) << left << endl;
+        }
+    return sReport;
+}
@@ -0,0 +1,114 @@
+/****************************************************************************
+**
+** ModbusFleet
+**
+**  Runs one compiled script per Modbus TCP device, many devices at once.
+**  Each DeviceSession owns its QModbusTcpClient and ScriptExecutor and
+**  lives on one of idealThreadCount() worker threads. Sockets cannot
+**  change threads once connected, so a new session goes to the thread
+**  with the fewest live sessions instead of being stolen later.
+**
+****************************************************************************/
+
+#ifndef MODBUSFLEET_H
+#define MODBUSFLEET_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMetaType>
+#include <QObject>
+#include <QVector>
+#include "modbusscript.h"
+#include "modbussettings.h"
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+class QThread;
+QT_END_NAMESPACE
+
+class ScriptExecutor;
+
+//one line of the hosts file: host:port [server] [script.csv]
+struct FleetDevice
+{
+    QString sHost;
+    int     iServerAddr = 1;
+    QString sScript;
+    ModbusProgram program;
+};
+
+struct SessionStats
+{
+    int     iId = -1;
+    bool    bConnected = false;
+    QString sError;
+    int     iRequests = 0;
+    int     iErrors = 0;
+    qint64  llTotalUs = 0;
+    qint64  llMinUs = -1;
+    qint64  llMaxUs = 0;
+};
+Q_DECLARE_METATYPE(SessionStats)
+
+class DeviceSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    DeviceSession(int iId, const FleetDevice &device, const ModbusSettings &settings, int iLoops);
+
+public slots:
+    void start();
+
+signals:
+    void finished(const SessionStats &stats);
+
+private:
+    void finish(const QString &sError);
+
+    FleetDevice m_device;
+    ModbusSettings m_settings;
+    int m_iLoops;
+    SessionStats m_stats;
+    ScriptExecutor *m_pScript = nullptr;
+    QModbusClient *modbusDevice = nullptr;
+    QElapsedTimer m_clock;
+    QHash<QModbusReply *, qint64> m_hashSentNs;
+    bool m_bDone = false;
+};
+
+class ModbusFleet : public QObject
+{
+    Q_OBJECT
+
+public:
+    ModbusFleet(const ModbusSettings &settings, int iLoops, QObject *parent = nullptr);
+    ~ModbusFleet();
+
+    static bool loadHosts(const QString &sFilename, const QString &sDefaultScript, int iDefaultServer,
+                          int iCoalesceGap, QVector<FleetDevice> &listDevices, QString &sError);
+    void start(const QVector<FleetDevice> &listDevices);
+    QString report() const;
+    int errors() const;
+
+signals:
+    void finished();
+
+private slots:
+    void onSessionFinished(const SessionStats &stats);
+
+private:
+    ModbusSettings m_settings;
+    int m_iLoops;
+    QVector<FleetDevice> m_listDevices;
+    QVector<SessionStats> m_listStats;
+    QVector<int> m_listThreadOf;    //session -> thread index
+    QVector<QThread *> m_listThreads;
+    QVector<int> m_listLoad;        //live sessions per thread
+    int m_iDone = 0;
+    QElapsedTimer m_timer;
+    qint64 m_llRunNs = 0;
+};
+
+#endif // MODBUSFLEET_H
@@ -0,0 +1,352 @@
+/****************************************************************************
+**
+** ScriptExecutor
+**
+**  Runs the loaded CSV rows as a state machine:
+**    send row -> (window has room) && (Wait(ms) elapsed) -> next step
+**  Wait(ms) is measured from the moment the request is queued (sent at
+**  once unless more urgent ones wait in the RequestQueue). With the
+**  default window of 1 "room" means the reply is in, and a failed reply
+**  retries the same step up to kMaxAttempts times. Pipelined runs leave
+**  retries to the client and drain the window at the end of each loop.
+**
+**  A Poll row keeps its step open: every pollInterval ms it re-reads the
+**  register until the condition holds or Wait(ms) has passed since the
+**  first read. Only the final reply is reported.
+**
+****************************************************************************/
+
+#include "scriptexecutor.h"
+
+#include <QModbusClient>
+#include <QModbusReply>
+#include <QDebug>
+
+static const int kMaxAttempts = 3;
+
+ScriptExecutor::ScriptExecutor(QObject *parent)
+    : QObject(parent)
+    , m_pOwnQueue(new RequestQueue(this))
+    , m_pQueue(m_pOwnQueue)
+    , m_timerWait(this)
+{
+    m_timerWait.setSingleShot(true);
+    m_timerWait.setTimerType(Qt::PreciseTimer);
+    connect(&m_timerWait, &QTimer::timeout, this, &ScriptExecutor::onWaitTimeout);
+}
+
+void ScriptExecutor::setDevice(QModbusClient *device)
+{
+    if (m_bRunning)
+        stop();
+    modbusDevice = device;
+    m_pOwnQueue->setDevice(device);
+}
+
+void ScriptExecutor::setStats(ModbusStats *pStats)
+{
+    m_pStats = pStats;
+    m_pOwnQueue->setStats(pStats);
+}
+
+//nullptr = back to the private queue
+void ScriptExecutor::setQueue(RequestQueue *pQueue)
+{
+    if (m_bRunning)
+        stop();
+    m_pQueue = pQueue ? pQueue : m_pOwnQueue;
+}
+
+void ScriptExecutor::setScript(const ModbusProgram &program)
+{
+    m_program = program;
+}
+
+void ScriptExecutor::setWindow(int iWindow)
+{
+    m_iWindow = qMax(1, iWindow);
+    m_pOwnQueue->setWindow(m_iWindow);
+}
+
+void ScriptExecutor::setPollInterval(int iInterval)
+{
+    m_iPollInterval = qMax(0, iInterval);
+}
+
+//iMaxAgeMs is the default for rows without a MaxAge(ms), 0 = off
+void ScriptExecutor::setCache(ProcessImage *pImage, int iMaxAgeMs)
+{
+    m_pImage = pImage;
+    m_iCacheAge = qMax(0, iMaxAgeMs);
+}
+
+void ScriptExecutor::start(int iLoops, int iServerAddr, bool bDryRun)
+{
+    if (m_bRunning)
+        return;
+
+    m_bDryRun = bDryRun;
+    m_iServerAddr = iServerAddr;
+    m_iLoops = iLoops;
+    if ((m_iLoops <= 0) || m_program.isEmpty() || (!m_bDryRun && !modbusDevice)) {
+        emit finished();
+        return;
+        }
+
+    m_bRunning = true;
+    startLoop();
+}
+
+void ScriptExecutor::stop()
+{
+    if (!m_bRunning)
+        return;
+
+    m_bRunning = false;
+    m_bDraining = false;
+    m_bPollPending = false;
+    m_timerWait.stop();
+    m_pQueue->cancel(this);
+    m_iQueued = 0;
+    //let the client finish them, nobody is waiting for the results anymore
+    for (auto it = m_hashInFlight.constBegin(); it != m_hashInFlight.constEnd(); ++it) {
+        QModbusReply *reply = it.key();
+        disconnect(reply, nullptr, this, nullptr);
+        connect(reply, &QModbusReply::finished, reply, &QObject::deleteLater);
+        }
+    m_hashInFlight.clear();
+    emit finished();
+}
+
+void ScriptExecutor::startLoop()
+{
+    emit loopStarted(m_iLoops);
+    m_iOp = -1;
+    nextOp();
+}
+
+void ScriptExecutor::nextOp()
+{
+    //skip rows not marked Act/Run
+    for (m_iOp++; m_iOp < m_program.size(); m_iOp++) {
+        if (m_program.at(m_iOp).bRun && (m_program.at(m_iOp).loop > 0))
+            break;
+        }
+
+    if (m_iOp >= m_program.size()) {
+        if (!isIdle())
+            m_bDraining = true; //finishLoop() once the last reply is in
+        else
+            finishLoop();
+        return;
+        }
+
+    if (m_program.at(m_iOp).slices.isEmpty())
+        emit rowStarted(m_program.at(m_iOp).row);
+    m_iOpLoop = 0;
+    m_iAttempt = 0;
+    m_iPolls = 0;
+    sendStep();
+}
+
+void ScriptExecutor::finishLoop()
+{
+    m_bDraining = false;
+    m_iLoops--;
+    emit loopFinished(m_iLoops);
+    if ((m_iLoops > 0) && m_bRunning) {
+        startLoop();
+        }
+    else {
+        m_bRunning = false;
+        emit finished();
+        }
+}
+
+void ScriptExecutor::sendStep()
+{
+    const ModbusOp &op = m_program.at(m_iOp);
+    if (op.bPoll) {
+        if (m_iPolls++ == 0) {
+            emit message(op.sStep);
+            m_timerPoll.start();
+            m_bPollDone = false;
+            }
+        }
+    else if (op.slices.isEmpty()) {
+        emit message(op.sStep);
+        }
+    else {
+        for (const ModbusSlice &slice : op.slices) {
+            emit rowStarted(slice.row);
+            emit message(slice.sStep);
+            }
+        }
+
+    m_bWaitDone = false;
+    m_bRetry = false;
+    if (!m_bDryRun && op.fc && !readCached(op)) {
+        m_bPollPending = op.bPoll;
+        sendRequest(op);
+        }
+    else if (op.bPoll) {
+        m_bPollDone = true; //dry run, nothing to wait for
+        }
+
+    //Wait(ms) counts from send, a 0ms wait still yields to the event loop
+    m_timerWait.start(op.bPoll ? m_iPollInterval : op.wait);
+}
+
+//the queue may send it right away or after more urgent requests, the
+//step state is only touched from the callback
+void ScriptExecutor::sendRequest(const ModbusOp &op)
+{
+    const int iOp = m_iOp;
+    m_iQueued++;
+    m_pQueue->submit(this, RequestQueue::priorityOf(op, RequestQueue::eAction), op, op.slave ? op.slave : m_iServerAddr,
+                     [this, iOp](QModbusReply *reply, bool bExpired) {
+        m_iQueued--;
+        const ModbusOp &op = m_program.at(iOp);
+        if (reply) {
+            emit requestSent(op.row, reply);
+            if (!reply->isFinished()) {
+                m_hashInFlight.insert(reply, iOp);
+                connect(reply, &QModbusReply::finished, this, &ScriptExecutor::onReplyFinished);
+                return;
+                }
+            delete reply; // broadcast replies return immediately
+            }
+        else if (bExpired) {
+            emit message(tr("Deadline missed, not sent"));
+            }
+        else {
+            emit message(tr("Send error: ") + (modbusDevice ? modbusDevice->errorString() : QString()));
+            }
+        if (op.bPoll) {
+            m_bPollPending = false;
+            m_bPollDone = true; //nothing to wait for
+            }
+        requestDone();
+        });
+}
+
+//a reply or a request that ended without one
+void ScriptExecutor::requestDone()
+{
+    if (!m_bRunning)
+        return;
+    if (m_bDraining) {
+        if (isIdle())
+            finishLoop();
+        return;
+        }
+    tryAdvance();
+}
+
+//Only with nothing in flight, a pending write could still change the value
+bool ScriptExecutor::readCached(const ModbusOp &op)
+{
+    if (!m_pImage || op.bPoll || !ModbusScript::isRead(op) || !isIdle())
+        return false;
+    const int iMaxAge = (op.maxAge >= 0) ? op.maxAge : m_iCacheAge;
+    if (iMaxAge <= 0)
+        return false;
+
+    QModbusDataUnit unit = op.unit;
+    const bool bHit = m_pImage->read(op.slave ? op.slave : m_iServerAddr, unit, iMaxAge);
+    if (m_pStats) {
+        if (bHit)
+            m_pStats->cacheHit();
+        else
+            m_pStats->cacheMiss();
+        }
+    if (!bHit)
+        return false;
+    if (op.slices.isEmpty()) {
+        emit cachedReady(op.row, unit);
+        }
+    else {
+        for (const ModbusSlice &slice : op.slices)
+            emit cachedReady(slice.row, ModbusScript::sliceUnit(unit, slice));
+        }
+    return true;
+}
+
+void ScriptExecutor::onReplyFinished()
+{
+    auto reply = qobject_cast<QModbusReply *>(sender());
+    if (!reply) return;
+    if (m_pStats)
+        m_pStats->replyFinished(reply);
+    if (!m_hashInFlight.contains(reply)) {
+        reply->deleteLater();
+        return;
+        }
+    const int iOp = m_hashInFlight.take(reply);
+
+    //fan a merged reply back out to the rows it was built from
+    const ModbusOp &op = m_program.at(iOp);
+    const QModbusDataUnit unit = reply->result();
+    if (op.bPoll) {
+        m_bPollPending = false;
+        bool bMatch = (reply->error() == QModbusDevice::NoError) && (unit.valueCount() > 0)
+                && ((unit.value(0) & op.pollMask) == op.pollValue);
+        if (bMatch || m_timerPoll.hasExpired(op.wait)) {
+            m_bPollDone = true;
+            emit replyReady(op.row, reply, unit);
+            emit message(QString("%1 after %2 reads, %3ms").arg(bMatch ? "  Poll ok" : "!!! Poll timeout")
+                         .arg(m_iPolls).arg(m_timerPoll.elapsed()));
+            }
+        }
+    else if (op.slices.isEmpty()) {
+        emit replyReady(op.row, reply, unit);
+        }
+    else {
+        for (const ModbusSlice &slice : op.slices)
+            emit replyReady(slice.row, reply, ModbusScript::sliceUnit(unit, slice));
+        }
+    //with a window of 1 the failed reply always belongs to the current step
+    //a Poll row just reads again until its own timeout
+    if ((m_iWindow == 1) && !op.bPoll && (reply->error() != QModbusDevice::NoError) && (++m_iAttempt < kMaxAttempts))
+        m_bRetry = true;
+    reply->deleteLater();
+    requestDone();
+}
+
+void ScriptExecutor::onWaitTimeout()
+{
+    m_bWaitDone = true;
+    tryAdvance();
+}
+
+void ScriptExecutor::tryAdvance()
+{
+    if (m_bWaitDone && !m_bDraining && !m_bPollPending && (m_hashInFlight.size() + m_iQueued < m_iWindow))
+        stepDone();
+}
+
+void ScriptExecutor::stepDone()
+{
+    if (!m_bRunning)
+        return;
+
+    if (m_bRetry) {
+        qDebug() << "Retry row" << m_program.at(m_iOp).row << "attempt" << m_iAttempt;
+        if (m_pStats)
+            m_pStats->retried();
+        sendStep();
+        return;
+        }
+
+    if (m_program.at(m_iOp).bPoll && !m_bPollDone) {
+        sendStep();
+        return;
+        }
+
+    m_iAttempt = 0;
+    m_iPolls = 0;
+    if (++m_iOpLoop < m_program.at(m_iOp).loop)
+        sendStep();
+    else
+        nextOp();
+}
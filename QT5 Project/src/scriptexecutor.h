@@ -0,0 +1,120 @@
+/****************************************************************************
+**
+** ScriptExecutor
+**
+**  Event driven CSV script engine. Each step is advanced by
+**  QModbusReply::finished and a single-shot wait timer, so the GUI thread
+**  never sleeps and a row completes as soon as its reply is in.
+**
+**  With a window > 1 (Modbus TCP only) up to that many requests stay in
+**  flight; QModbusTcpClient pairs the replies by transaction id.
+**
+**  Poll rows re-read one register every pollInterval ms until the
+**  mask/value condition holds or their Wait(ms) timeout expires.
+**
+**  With a ProcessImage set, Rr/Rc rows whose values are younger than
+**  their max age are answered from it (cachedReady) without a request.
+**
+**  Requests go through a RequestQueue in the action class (or the row's
+**  own), a private one unless setQueue() shares one with the scheduler
+**  and the manual sends.
+**
+****************************************************************************/
+
+#ifndef SCRIPTEXECUTOR_H
+#define SCRIPTEXECUTOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+#include "modbusscript.h"
+#include "modbusstats.h"
+#include "processimage.h"
+#include "requestqueue.h"
+
+QT_BEGIN_NAMESPACE
+class QModbusClient;
+class QModbusReply;
+QT_END_NAMESPACE
+
+class ScriptExecutor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScriptExecutor(QObject *parent = nullptr);
+
+    void setDevice(QModbusClient *device);
+    void setScript(const ModbusProgram &program);
+    void setWindow(int iWindow);
+    void setPollInterval(int iInterval);
+    void setStats(ModbusStats *pStats);
+    void setQueue(RequestQueue *pQueue);
+    void setCache(ProcessImage *pImage, int iMaxAgeMs);
+    bool isRunning() const { return m_bRunning; }
+
+public slots:
+    void start(int iLoops, int iServerAddr, bool bDryRun);
+    void stop();
+
+signals:
+    void loopStarted(int iLoop);
+    void loopFinished(int iLoopsLeft);
+    void rowStarted(int row);
+    void message(const QString &sMsg);
+    void requestSent(int row, QModbusReply *reply);
+    void replyReady(int row, QModbusReply *reply, const QModbusDataUnit &unit);
+    void cachedReady(int row, const QModbusDataUnit &unit);
+    void finished();
+
+private slots:
+    void onReplyFinished();
+    void onWaitTimeout();
+
+private:
+    void startLoop();
+    void nextOp();
+    void sendStep();
+    void tryAdvance();
+    void stepDone();
+    void finishLoop();
+    void sendRequest(const ModbusOp &op);
+    void requestDone();
+    bool isIdle() const { return m_hashInFlight.isEmpty() && !m_iQueued; }
+    bool readCached(const ModbusOp &op);
+
+    QModbusClient *modbusDevice = nullptr;
+    ModbusStats *m_pStats = nullptr;
+    RequestQueue *m_pOwnQueue;
+    RequestQueue *m_pQueue;
+    int m_iQueued = 0;          //submitted, not sent yet
+    ProcessImage *m_pImage = nullptr;
+    int m_iCacheAge = 0;
+    QHash<QModbusReply *, int> m_hashInFlight;  //reply -> op index
+    ModbusProgram m_program;
+    QTimer m_timerWait;         //child, moveToThread() takes it along
+
+    bool m_bRunning = false;
+    bool m_bDryRun = true;
+    int m_iServerAddr = 1;
+    int m_iLoops = 0;
+    int m_iWindow = 1;
+    int m_iPollInterval = 10;
+
+    //current step
+    int m_iOp = -1;
+    int m_iOpLoop = 0;
+    int m_iAttempt = 0;
+    bool m_bWaitDone = false;
+    bool m_bRetry = false;
+    bool m_bDraining = false;   //end of loop, waiting for the window to empty
+
+    //current Poll row
+    QElapsedTimer m_timerPoll;
+    int m_iPolls = 0;
+    bool m_bPollPending = false;
+    bool m_bPollDone = false;
+};
+
+#endif // SCRIPTEXECUTOR_H
@@ -0,0 +1,131 @@
+#include "serialtty.h"
+
+#include <QFile>
+#include <QSerialPort>
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/serial.h>
+
+static speed_t speedFromBaud(int baud)
+{
+    switch (baud) {
+        case 1200:   return B1200;
+        case 2400:   return B2400;
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default:     return B0;
+        }
+}
+
+static timespec toTimespec(qint64 llNs)
+{
+    timespec ts;
+    ts.tv_sec = llNs / 1000000000;
+    ts.tv_nsec = llNs % 1000000000;
+    return ts;
+}
+
+int openSerialTty(const QString &sPort, int baud, int parity, int dataBits, int stopBits, QString &sError)
+{
+    const speed_t speed = speedFromBaud(baud);
+    if (speed == B0) {
+        sError = QString("unsupported baud rate %1").arg(baud);
+        return -1;
+        }
+    const int fd = ::open(QFile::encodeName(sPort).constData(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        sError = QString::fromLocal8Bit(strerror(errno));
+        return -1;
+        }
+
+    termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        sError = QString::fromLocal8Bit(strerror(errno));
+        ::close(fd);
+        return -1;
+        }
+    cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSIZE | CSTOPB | PARENB | PARODD | CMSPAR | CRTSCTS);
+    tio.c_cflag |= CLOCAL | CREAD;
+    switch (dataBits) {
+        case QSerialPort::Data5: tio.c_cflag |= CS5; break;
+        case QSerialPort::Data6: tio.c_cflag |= CS6; break;
+        case QSerialPort::Data7: tio.c_cflag |= CS7; break;
+        default:                 tio.c_cflag |= CS8; break;
+        }
+    switch (parity) {
+        case QSerialPort::EvenParity:  tio.c_cflag |= PARENB; break;
+        case QSerialPort::OddParity:   tio.c_cflag |= PARENB | PARODD; break;
+        case QSerialPort::SpaceParity: tio.c_cflag |= PARENB | CMSPAR; break;
+        case QSerialPort::MarkParity:  tio.c_cflag |= PARENB | CMSPAR | PARODD; break;
+        default:                       break;
+        }
+    if (stopBits == QSerialPort::TwoStop)
+        tio.c_cflag |= CSTOPB;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+        sError = QString::fromLocal8Bit(strerror(errno));
+        ::close(fd);
+        return -1;
+        }
+
+    //hand every byte up at once instead of batching them in the driver,
+    //ptys and some USB adapters refuse which only costs latency
+    serial_struct serial;
+    if ((ioctl(fd, TIOCGSERIAL, &serial) == 0) && !(serial.flags & ASYNC_LOW_LATENCY)) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &serial) != 0)
+            qDebug() << "ASYNC_LOW_LATENCY refused on" << sPort;
+        }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+qint64 serialFrameGapNs(int baud, int parity, int dataBits, int stopBits)
+{
+    if (baud > 19200)
+        return 1750000;
+    //start, data, parity and stop bits per character
+    const int iBits = 1 + dataBits + ((parity == QSerialPort::NoParity) ? 0 : 1)
+            + ((stopBits == QSerialPort::TwoStop) ? 2 : 1);
+    return Q_INT64_C(1000000000) * iBits * 7 / (2 * qMax(1, baud));
+}
+
+qint64 monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+void sleepUntilNs(qint64 llAtNs)
+{
+    const timespec ts = toTimespec(llAtNs);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+}
+
+void armTimerNs(int timerfd, qint64 llAtNs)
+{
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value = toTimespec(llAtNs);
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
@@ -0,0 +1,23 @@
+/*
+**  Raw Linux tty and monotonic clock helpers shared by RtuDirectMaster
+**  and BusSniffer
+**
+*/
+
+#ifndef SERIALTTY_H
+#define SERIALTTY_H
+
+#include <QString>
+
+// QSerialPort enum values for parity, data and stop bits; returns the
+// non-blocking fd, raw 8N1-style termios with ASYNC_LOW_LATENCY, or -1
+int openSerialTty(const QString &sPort, int baud, int parity, int dataBits, int stopBits, QString &sError);
+// t3.5 at this line setting, fixed 1.75 ms above 19200 baud
+qint64 serialFrameGapNs(int baud, int parity, int dataBits, int stopBits);
+
+qint64 monotonicNs();
+void sleepUntilNs(qint64 llAtNs);
+// one-shot CLOCK_MONOTONIC timerfd at an absolute time
+void armTimerNs(int timerfd, qint64 llAtNs);
+
+#endif // SERIALTTY_H
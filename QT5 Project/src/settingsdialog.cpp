@@ -53,6 +53,11 @@ SettingsDialog::SettingsDialog(QWidget *parent) :
     ui->stopBitsCombo->setCurrentText(QString::number(m_settings.stopBits));
     ui->timeoutSpinner->setValue(m_settings.responseTime);
     ui->retriesSpinner->setValue(m_settings.numberOfRetries);
+    ui->coalesceSpinner->setValue(m_settings.coalesceGap);
+    ui->windowSpinner->setValue(m_settings.tcpWindow);
+    ui->pollSpinner->setValue(m_settings.pollInterval);
+    ui->cacheSpinner->setValue(m_settings.cacheMaxAge);
+    ui->adaptiveCheck->setChecked(m_settings.adaptiveTimeout);
 
     connect(ui->applyButton, &QPushButton::clicked, [this]() {
         m_settings.parity = ui->parityCombo->currentIndex();
@@ -63,6 +68,11 @@ SettingsDialog::SettingsDialog(QWidget *parent) :
         m_settings.stopBits = ui->stopBitsCombo->currentText().toInt();
         m_settings.responseTime = ui->timeoutSpinner->value();
         m_settings.numberOfRetries = ui->retriesSpinner->value();
+        m_settings.coalesceGap = ui->coalesceSpinner->value();
+        m_settings.tcpWindow = ui->windowSpinner->value();
+        m_settings.pollInterval = ui->pollSpinner->value();
+        m_settings.cacheMaxAge = ui->cacheSpinner->value();
+        m_settings.adaptiveTimeout = ui->adaptiveCheck->isChecked();
 
         hide();
     });
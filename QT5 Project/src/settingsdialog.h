@@ -42,7 +42,7 @@
 #define SETTINGSDIALOG_H
 
 #include <QDialog>
-#include <QSerialPort>
+#include "modbussettings.h"
 
 QT_BEGIN_NAMESPACE
 
@@ -57,14 +57,7 @@ class SettingsDialog : public QDialog
     Q_OBJECT
 
 public:
-    struct Settings {
-        int parity = QSerialPort::NoParity;
-        int baud = QSerialPort::Baud19200;
-        int dataBits = QSerialPort::Data8;
-        int stopBits = QSerialPort::OneStop;
-        int responseTime = 1000;
-        int numberOfRetries = 3;
-    };
+    typedef ModbusSettings Settings;
 
     explicit SettingsDialog(QWidget *parent = nullptr);
     ~SettingsDialog();
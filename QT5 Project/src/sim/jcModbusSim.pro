@@ -0,0 +1,25 @@
+QT = core serialbus serialport
+
+TARGET = ../../jcModbusSim
+TEMPLATE = app
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+#Output
+MOC_DIR     = moc
+OBJECTS_DIR = obj
+
+INCLUDEPATH += ..
+
+SOURCES += main.cpp \
+        simmodel.cpp \
+        ptybridge.cpp \
+        ../serialtty.cpp
+
+HEADERS += simmodel.h \
+        simserver.h \
+        ptybridge.h \
+        ../serialtty.h
+
+#openpty()
+unix:!macx: LIBS += -lutil
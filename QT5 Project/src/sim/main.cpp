@@ -0,0 +1,108 @@
+/****************************************************************************
+**
+** jcModbusSim
+**
+**  Local Modbus slave for the shipped CSV scripts (TC100 and MC0162
+**  register maps, see simmodel.h), no controller needed:
+**    jcModbusSim [-t 1502] [-r] [-b 19200] [--latency us] [--jitter us]
+**
+**  Prints one line per endpoint, "tcp <host:port>" and "rtu <pty>", then
+**  serves until killed. The RTU end is a pseudo-terminal paced at the
+**  given baud rate; --link adds a fixed symlink to it.
+**
+****************************************************************************/
+
+#include "simmodel.h"
+#include "simserver.h"
+#include "ptybridge.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QModbusRtuSerialSlave>
+#include <QModbusTcpServer>
+#include <QSerialPort>
+#include <QTextStream>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("jcModbusSim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Simulated TC100 / MC0162 Modbus slave");
+    parser.addHelpOption();
+    QCommandLineOption optTcp(QStringList() << "t" << "tcp", "Serve Modbus TCP on this port, 0 = off.", "port", "1502");
+    QCommandLineOption optRtu(QStringList() << "r" << "rtu", "Serve Modbus RTU on a pseudo-terminal.");
+    QCommandLineOption optBaud(QStringList() << "b" << "baud", "Simulated RTU line speed.", "baud", "19200");
+    QCommandLineOption optLink("link", "Symlink to the client end of the RTU pty.", "path");
+    QCommandLineOption optServer(QStringList() << "a" << "server", "Server address.", "id", "1");
+    QCommandLineOption optLatency("latency", "Response delay in us.", "us", "0");
+    QCommandLineOption optJitter("jitter", "Extra random delay, up to this many us.", "us", "0");
+    QCommandLineOption optVerbose(QStringList() << "v" << "verbose", "Keep qt.modbus logging.");
+    parser.addOptions({optTcp, optRtu, optBaud, optLink, optServer, optLatency, optJitter, optVerbose});
+    parser.process(a);
+
+    if (!parser.isSet(optVerbose))
+        QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false"));
+    else
+        QLoggingCategory::setFilterRules(QStringLiteral("qt.modbus* = true"));
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    const int iServerAddr = parser.value(optServer).toInt();
+    const int iLatencyUs = parser.value(optLatency).toInt();
+    const int iJitterUs = parser.value(optJitter).toInt();
+    const int iTcpPort = parser.value(optTcp).toInt();
+
+    if (iTcpPort > 0) {
+        auto *pServer = new SimServer<QModbusTcpServer>(&a);
+        pServer->setLatency(iLatencyUs, iJitterUs);
+        pServer->setMap(SimModel::registerMap());
+        pServer->setServerAddress(iServerAddr);
+        pServer->setConnectionParameter(QModbusDevice::NetworkAddressParameter, "127.0.0.1");
+        pServer->setConnectionParameter(QModbusDevice::NetworkPortParameter, iTcpPort);
+        new SimModel(pServer, pServer);
+        if (!pServer->connectDevice()) {
+            err << "TCP listen failed: " << pServer->errorString() << endl;
+            return 1;
+            }
+        out << "tcp 127.0.0.1:" << iTcpPort << endl;
+        }
+
+    if (parser.isSet(optRtu)) {
+        const int iBaud = parser.value(optBaud).toInt();
+        auto *pBridge = new PtyBridge(iBaud, &a);
+        QString sError;
+        if (!pBridge->open(sError)) {
+            err << sError << endl;
+            return 1;
+            }
+        auto *pServer = new SimServer<QModbusRtuSerialSlave>(&a);
+        pServer->setLatency(iLatencyUs, iJitterUs);
+        pServer->setMap(SimModel::registerMap());
+        pServer->setServerAddress(iServerAddr);
+        pServer->setConnectionParameter(QModbusDevice::SerialPortNameParameter, pBridge->serverPort());
+        pServer->setConnectionParameter(QModbusDevice::SerialBaudRateParameter, iBaud);
+        pServer->setConnectionParameter(QModbusDevice::SerialParityParameter, QSerialPort::NoParity);
+        pServer->setConnectionParameter(QModbusDevice::SerialDataBitsParameter, QSerialPort::Data8);
+        pServer->setConnectionParameter(QModbusDevice::SerialStopBitsParameter, QSerialPort::OneStop);
+        new SimModel(pServer, pServer);
+        if (!pServer->connectDevice()) {
+            err << "RTU open failed: " << pServer->errorString() << endl;
+            return 1;
+            }
+        QString sPort = pBridge->clientPort();
+        if (parser.isSet(optLink)) {
+            QFile::remove(parser.value(optLink));
+            if (QFile::link(sPort, parser.value(optLink)))
+                sPort = parser.value(optLink);
+            }
+        out << "rtu " << sPort << endl;
+        }
+
+    if ((iTcpPort <= 0) && !parser.isSet(optRtu))
+        parser.showHelp(1);
+    return a.exec();
+}
@@ -0,0 +1,107 @@
+/*
+**  PtyBridge, Linux openpty() pair copied through QSocketNotifier, the
+**  release time of each lane on an absolute CLOCK_MONOTONIC timerfd
+**
+*/
+
+#include "ptybridge.h"
+#include "serialtty.h"
+
+#include <QSocketNotifier>
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/timerfd.h>
+
+static bool openRawPty(int &fdMaster, int &fdSlave, QString &sName)
+{
+    char name[64];
+    if (openpty(&fdMaster, &fdSlave, name, nullptr, nullptr) < 0)
+        return false;
+    struct termios tio;
+    tcgetattr(fdSlave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fdSlave, TCSANOW, &tio);
+    fcntl(fdMaster, F_SETFL, fcntl(fdMaster, F_GETFL) | O_NONBLOCK);
+    sName = QString::fromLocal8Bit(name);
+    return true;
+}
+
+PtyBridge::PtyBridge(int iBaud, QObject *parent)
+    : QObject(parent)
+    , m_iBaud(qMax(300, iBaud))
+{
+}
+
+PtyBridge::~PtyBridge()
+{
+    for (int fd : {m_fdServer, m_fdClient, m_fdServerSlave, m_fdClientSlave,
+                   m_laneToServer.timerfd, m_laneToClient.timerfd}) {
+        if (fd >= 0)
+            ::close(fd);
+        }
+}
+
+bool PtyBridge::open(QString &sError)
+{
+    if (!openRawPty(m_fdServer, m_fdServerSlave, m_sServerPort)
+            || !openRawPty(m_fdClient, m_fdClientSlave, m_sClientPort)) {
+        sError = QString("openpty: ") + strerror(errno);
+        return false;
+        }
+
+    m_laneToServer.fdIn = m_fdClient;
+    m_laneToServer.fdOut = m_fdServer;
+    m_laneToClient.fdIn = m_fdServer;
+    m_laneToClient.fdOut = m_fdClient;
+    for (PtyLane *pLane : {&m_laneToServer, &m_laneToClient}) {
+        pLane->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (pLane->timerfd < 0) {
+            sError = QString("timerfd: ") + strerror(errno);
+            return false;
+            }
+        pLane->pNotifier = new QSocketNotifier(pLane->fdIn, QSocketNotifier::Read, this);
+        connect(pLane->pNotifier, &QSocketNotifier::activated, this, [this, pLane]() { onReadable(*pLane); });
+        pLane->pTimerNotifier = new QSocketNotifier(pLane->timerfd, QSocketNotifier::Read, this);
+        connect(pLane->pTimerNotifier, &QSocketNotifier::activated, this, [this, pLane]() {
+            quint64 uExpirations;
+            if (::read(pLane->timerfd, &uExpirations, sizeof(uExpirations)) < 0)
+                return; //spurious, still armed
+            pLane->bArmed = false;
+            onRelease(*pLane);
+            });
+        }
+    return true;
+}
+
+//queue what came in, due when the line would have finished shifting it out
+void PtyBridge::onReadable(PtyLane &lane)
+{
+    char buf[4096];
+    ssize_t n;
+    while ((n = ::read(lane.fdIn, buf, sizeof(buf))) > 0) {
+        qint64 llNowNs = monotonicNs();
+        qint64 llStartNs = qMax(llNowNs, lane.llFreeNs);
+        lane.llFreeNs = llStartNs + n*10*Q_INT64_C(1000000000)/m_iBaud;
+        lane.queueChunks.enqueue(qMakePair(lane.llFreeNs, QByteArray(buf, static_cast<int>(n))));
+        }
+    if (!lane.bArmed)
+        onRelease(lane);
+}
+
+void PtyBridge::onRelease(PtyLane &lane)
+{
+    qint64 llNowNs = monotonicNs();
+    while (!lane.queueChunks.isEmpty() && (lane.queueChunks.head().first <= llNowNs)) {
+        const QByteArray bytes = lane.queueChunks.dequeue().second;
+        if (::write(lane.fdOut, bytes.constData(), static_cast<size_t>(bytes.size())) < 0)
+            break; //nobody on the other end, drop
+        }
+    if (!lane.queueChunks.isEmpty()) {
+        armTimerNs(lane.timerfd, lane.queueChunks.head().first);
+        lane.bArmed = true;
+        }
+}
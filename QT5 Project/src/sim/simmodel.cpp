@@ -0,0 +1,215 @@
+/****************************************************************************
+**
+** SimModel
+**
+**  Client writes arrive through QModbusServer::dataWritten, the model
+**  reacts and updates the status registers; a 2ms tick moves the axes.
+**  dataWritten only fires on a changed value, so command registers and
+**  coils clear themselves once handled, the next identical write acts.
+**
+****************************************************************************/
+
+#include "simmodel.h"
+
+#include <QDebug>
+
+static const int kTickMs = 2;
+static const int kJogStep = 1000;
+
+SimModel::SimModel(QModbusServer *server, QObject *parent)
+    : QObject(parent)
+    , m_pServer(server)
+{
+    m_bUpdating = true;
+    setAscii(0x10D0, "TC-MOTOR");
+    setAscii(0x10E0, "TC100   ");
+    setAscii(0x10F0, "SIM 1.00");
+    setReg(0x2014, static_cast<quint16>(m_axisTC100.iSpeed));
+    setReg(0x2011, 1);
+    m_bUpdating = false;
+    publish();
+
+    connect(m_pServer, &QModbusServer::dataWritten, this, &SimModel::onDataWritten);
+    m_timerMotion.setTimerType(Qt::PreciseTimer);
+    m_timerMotion.setInterval(kTickMs);
+    connect(&m_timerMotion, &QTimer::timeout, this, &SimModel::onMotionTick);
+}
+
+//every address of every table exists, reads never fail with IllegalDataAddress
+QModbusDataUnitMap SimModel::registerMap()
+{
+    QModbusDataUnitMap map;
+    map.insert(QModbusDataUnit::Coils, QModbusDataUnit(QModbusDataUnit::Coils, 0, 0xFFFF));
+    map.insert(QModbusDataUnit::DiscreteInputs, QModbusDataUnit(QModbusDataUnit::DiscreteInputs, 0, 0xFFFF));
+    map.insert(QModbusDataUnit::InputRegisters, QModbusDataUnit(QModbusDataUnit::InputRegisters, 0, 0xFFFF));
+    map.insert(QModbusDataUnit::HoldingRegisters, QModbusDataUnit(QModbusDataUnit::HoldingRegisters, 0, 0xFFFF));
+    return map;
+}
+
+quint16 SimModel::reg(int iAddr) const
+{
+    quint16 value = 0;
+    m_pServer->data(QModbusDataUnit::HoldingRegisters, static_cast<quint16>(iAddr), &value);
+    return value;
+}
+
+qint32 SimModel::reg32(int iAddr) const
+{
+    return static_cast<qint32>((static_cast<quint32>(reg(iAddr)) << 16) | reg(iAddr + 1));
+}
+
+void SimModel::setReg(int iAddr, quint16 value)
+{
+    m_pServer->setData(QModbusDataUnit::HoldingRegisters, static_cast<quint16>(iAddr), value);
+}
+
+void SimModel::setReg32(int iAddr, qint32 value)
+{
+    setReg(iAddr, static_cast<quint16>(static_cast<quint32>(value) >> 16));
+    setReg(iAddr + 1, static_cast<quint16>(value & 0xFFFF));
+}
+
+void SimModel::setBit(QModbusDataUnit::RegisterType table, int iAddr, bool bOn)
+{
+    m_pServer->setData(table, static_cast<quint16>(iAddr), bOn ? 1 : 0);
+}
+
+//write from the model itself, no dataWritten handling
+void SimModel::setStatus(int iAddr, quint16 value)
+{
+    m_bUpdating = true;
+    setReg(iAddr, value);
+    m_bUpdating = false;
+}
+
+void SimModel::setAscii(int iAddr, const char *s)
+{
+    for (int i = 0; i < 8; i++) {
+        char c1 = *s ? *s++ : ' ';
+        char c2 = *s ? *s++ : ' ';
+        setReg(iAddr + i, static_cast<quint16>((c1 << 8) | c2));
+        }
+}
+
+void SimModel::startMove(SimAxis &axis, qint32 iTarget)
+{
+    axis.iStart = axis.iPos;
+    axis.iTarget = iTarget;
+    axis.bMoving = (axis.iPos != iTarget);
+    axis.timer.start();
+    if (axis.bMoving && !m_timerMotion.isActive())
+        m_timerMotion.start();
+}
+
+void SimModel::stopMove(SimAxis &axis)
+{
+    axis.bMoving = false;
+    axis.iTarget = axis.iPos;
+}
+
+void SimModel::onDataWritten(QModbusDataUnit::RegisterType table, int address, int size)
+{
+    if (m_bUpdating)
+        return;
+
+    for (int iAddr = address; iAddr < address + size; iAddr++) {
+        if (table == QModbusDataUnit::HoldingRegisters) {
+            quint16 value = reg(iAddr);
+            switch (iAddr) {
+                case 0x2011: //TC100 servo, 0 = on
+                    if (value != 0)
+                        stopMove(m_axisTC100);
+                    break;
+                case 0x2014:
+                    m_axisTC100.iSpeed = qMax(1, static_cast<int>(value));
+                    break;
+                case 0x201E: //TC100 move type
+                    if (reg(0x2011) != 0)
+                        break; //servo off, ignored
+                    if (value == 0x01)
+                        startMove(m_axisTC100, reg32(0x2002));
+                    else if (value == 0x03)
+                        startMove(m_axisTC100, 0);
+                    else if (value == 0x0B)
+                        startMove(m_axisTC100, m_axisTC100.iPos + kJogStep);
+                    else if (value == 0x0C)
+                        startMove(m_axisTC100, m_axisTC100.iPos - kJogStep);
+                    else if (value == 0x09)
+                        stopMove(m_axisTC100);
+                    else if (value == 0x06)
+                        setStatus(0x1005, 0);
+                    setStatus(0x201E, 0);
+                    break;
+                }
+            }
+        else if ((table == QModbusDataUnit::Coils) && (iAddr >= 0x0400) && (iAddr < 0x0430)) {
+            quint16 value = 0;
+            m_pServer->data(QModbusDataUnit::Coils, static_cast<quint16>(iAddr), &value);
+            if (!value || (iAddr == 0x0403) || (iAddr == 0x0427) || (iAddr == 0x040A))
+                continue; //level coils
+            m_pServer->data(QModbusDataUnit::Coils, 0x0403, &value);
+            bool bServo = (value != 0);
+            m_bUpdating = true;
+            setBit(QModbusDataUnit::Coils, iAddr, false);
+            m_bUpdating = false;
+            switch (iAddr) {
+                case 0x040B: //home
+                    if (bServo) startMove(m_axisMC0162, 0);
+                    break;
+                case 0x040C: //start move to 0x9900
+                    if (bServo) startMove(m_axisMC0162, reg32(0x9900));
+                    break;
+                case 0x0416:
+                    if (bServo) startMove(m_axisMC0162, m_axisMC0162.iPos + kJogStep);
+                    break;
+                case 0x0417:
+                    if (bServo) startMove(m_axisMC0162, m_axisMC0162.iPos - kJogStep);
+                    break;
+                }
+            }
+        }
+    publish();
+}
+
+void SimModel::onMotionTick()
+{
+    bool bMoving = false;
+    for (SimAxis *pAxis : {&m_axisTC100, &m_axisMC0162}) {
+        SimAxis &axis = *pAxis;
+        if (!axis.bMoving)
+            continue;
+        qint64 llDone = axis.timer.elapsed()*axis.iSpeed/4;
+        qint64 llDistance = qAbs(static_cast<qint64>(axis.iTarget) - axis.iStart);
+        if (llDone >= llDistance) {
+            axis.iPos = axis.iTarget;
+            axis.bMoving = false;
+            }
+        else {
+            axis.iPos = static_cast<qint32>(axis.iStart + ((axis.iTarget > axis.iStart) ? llDone : -llDone));
+            bMoving = true;
+            }
+        }
+    if (!bMoving)
+        m_timerMotion.stop();
+    publish();
+}
+
+//status registers from the axis state
+void SimModel::publish()
+{
+    m_bUpdating = true;
+    bool bServoTC100 = (reg(0x2011) == 0);
+    bool bInPosTC100 = !m_axisTC100.bMoving && (m_axisTC100.iPos == m_axisTC100.iTarget);
+    setReg(0x0700, bInPosTC100 ? 1 : 0);
+    setReg(0x1000, m_axisTC100.bMoving ? 1 : 0);
+    setReg(0x1001, bInPosTC100 ? 1 : 0);
+    setReg(0x100C, bServoTC100 ? 1 : 0);
+    setReg32(0x1010, m_axisTC100.iPos);
+
+    quint16 value = 0;
+    m_pServer->data(QModbusDataUnit::Coils, 0x0403, &value);
+    setBit(QModbusDataUnit::DiscreteInputs, 0x9000, !m_axisMC0162.bMoving);
+    setBit(QModbusDataUnit::DiscreteInputs, 0x9001, value != 0);
+    setReg32(0x9000, m_axisMC0162.iPos);
+    m_bUpdating = false;
+}
@@ -0,0 +1,84 @@
+/****************************************************************************
+**
+** SimModel
+**
+**  Register map of the controllers the shipped CSV scripts talk to,
+**  served from one QModbusServer. The two maps use different tables or
+**  addresses so one server answers both.
+**
+**  TC100 (holding registers)
+**    0x0700      InPosition       1 = at target
+**    0x1000      ActionStatus     1 = moving
+**    0x1001      InpStatus        1 = at target
+**    0x1005      AlarmStatus
+**    0x100C      ServoStatus      1 = servo on
+**    0x100D      ErrorStatus
+**    0x1010/11   position hi/lo   (simulator only)
+**    0x10D0..    MotorType, Controller, FirmwareNo, 8 regs ASCII each
+**    0x2002/03   target hi/lo
+**    0x2011      servo            0 = on, 1 = off
+**    0x2014      speed            speed*250 units/s
+**    0x201E      move type        1 ABS, 3 ORG, 6 reset alarm, 9 stop,
+**                                 B jog+, C jog-, reads back 0 when done
+**  MC0162 (coils / discrete inputs)
+**    coil 0x0403 servo on, 0x0407 alarm reset, 0x040B home,
+**         0x040C start move to 0x9900, 0x0416/0x0417 jog+/-
+**         (command coils clear themselves)
+**    holding 0x9900/01 target hi/lo, 0x9000/01 position hi/lo
+**    input   0x9000 in position, 0x9001 servo on
+**
+****************************************************************************/
+
+#ifndef SIMMODEL_H
+#define SIMMODEL_H
+
+#include <QElapsedTimer>
+#include <QModbusDataUnit>
+#include <QModbusServer>
+#include <QObject>
+#include <QTimer>
+
+//one moving axis, position follows elapsed time
+struct SimAxis
+{
+    qint32 iStart = 0;
+    qint32 iPos = 0;
+    qint32 iTarget = 0;
+    int    iSpeed = 64;     //speed*250 units/s
+    bool   bMoving = false;
+    QElapsedTimer timer;
+};
+
+class SimModel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SimModel(QModbusServer *server, QObject *parent = nullptr);
+
+    static QModbusDataUnitMap registerMap();
+
+private slots:
+    void onDataWritten(QModbusDataUnit::RegisterType table, int address, int size);
+    void onMotionTick();
+
+private:
+    quint16 reg(int iAddr) const;
+    qint32 reg32(int iAddr) const;
+    void setReg(int iAddr, quint16 value);
+    void setReg32(int iAddr, qint32 value);
+    void setBit(QModbusDataUnit::RegisterType table, int iAddr, bool bOn);
+    void setStatus(int iAddr, quint16 value);
+    void setAscii(int iAddr, const char *s);
+    void startMove(SimAxis &axis, qint32 iTarget);
+    void stopMove(SimAxis &axis);
+    void publish();
+
+    QModbusServer *m_pServer;
+    QTimer m_timerMotion;
+    SimAxis m_axisTC100;
+    SimAxis m_axisMC0162;
+    bool m_bUpdating = false;   //own writes, not client requests
+};
+
+#endif // SIMMODEL_H
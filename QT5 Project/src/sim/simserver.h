@@ -0,0 +1,46 @@
+/****************************************************************************
+**
+** SimServer
+**
+**  QModbusTcpServer / QModbusRtuSerialSlave with a response delay of
+**  latency + uniform [0, jitter] us before every request is processed.
+**  The server thread blocks like a slave CPU would.
+**
+****************************************************************************/
+
+#ifndef SIMSERVER_H
+#define SIMSERVER_H
+
+#include <QModbusPdu>
+#include <QRandomGenerator>
+#include <QThread>
+
+template <typename Server>
+class SimServer : public Server
+{
+public:
+    explicit SimServer(QObject *parent = nullptr) : Server(parent) {}
+
+    void setLatency(int iLatencyUs, int iJitterUs)
+    {
+        m_iLatencyUs = qMax(0, iLatencyUs);
+        m_iJitterUs = qMax(0, iJitterUs);
+    }
+
+protected:
+    QModbusResponse processRequest(const QModbusPdu &request) override
+    {
+        int iDelayUs = m_iLatencyUs;
+        if (m_iJitterUs > 0)
+            iDelayUs += static_cast<int>(QRandomGenerator::global()->bounded(m_iJitterUs + 1));
+        if (iDelayUs > 0)
+            QThread::usleep(static_cast<unsigned long>(iDelayUs));
+        return Server::processRequest(request);
+    }
+
+private:
+    int m_iLatencyUs = 0;
+    int m_iJitterUs = 0;
+};
+
+#endif // SIMSERVER_H
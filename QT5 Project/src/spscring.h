@@ -0,0 +1,51 @@
+/*
+**  Single producer / single consumer lock-free ring buffer
+**
+**  push() from exactly one thread, pop() from exactly one other thread.
+**  N must be a power of 2, indices run freely and wrap with the mask.
+*/
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <utility>
+
+template <typename T, unsigned N>
+class SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of 2");
+
+public:
+    bool push(const T &item)
+    {
+        unsigned uHead = m_uHead.load(std::memory_order_relaxed);
+        if (uHead - m_uTail.load(std::memory_order_acquire) >= N)
+            return false; //full
+        m_items[uHead & (N - 1)] = item;
+        m_uHead.store(uHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        unsigned uTail = m_uTail.load(std::memory_order_relaxed);
+        if (uTail == m_uHead.load(std::memory_order_acquire))
+            return false; //empty
+        item = std::move(m_items[uTail & (N - 1)]);
+        m_uTail.store(uTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const
+    {
+        return m_uTail.load(std::memory_order_acquire) == m_uHead.load(std::memory_order_acquire);
+    }
+
+private:
+    T m_items[N];
+    alignas(64) std::atomic<unsigned> m_uHead{0};
+    alignas(64) std::atomic<unsigned> m_uTail{0};
+};
+
+#endif // SPSCRING_H
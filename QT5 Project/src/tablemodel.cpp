@@ -34,7 +34,7 @@ QVariant TableModel::data(const QModelIndex &index, int role) const
     switch (role) {
         case Qt::EditRole:
         case Qt::DisplayRole:
-            return strings.at(index.column());
+            return strings.value(index.column()); //optional columns may be missing
             break;
         case Qt::DecorationRole:
             if (index.column()== enumModbusCSV::eActRun) {
@@ -104,6 +104,8 @@ bool TableModel::setData(const QModelIndex &index, const QVariant &value, int ro
     if (index.isValid() && role == Qt::EditRole) {
         int row = index.row();
         auto strings = stringLists.at(row);
+        while (strings.size() <= index.column())
+            strings.append(QString());
         strings[index.column()]=value.toString();
         stringLists.replace(row, strings);
         emit dataChanged(index, index, {role});